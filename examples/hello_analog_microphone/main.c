@@ -32,6 +32,10 @@ const struct analog_microphone_config config = {
 
 // variables
 int16_t sample_buffer[256];
+
+// the two raw buffers the DMA fills, in SRAM4 rather than the striped banks
+// the code works in
+uint16_t raw_buffers[ANALOG_MICROPHONE_RAW_POOL_SIZE(256, 2)] MIC_HAL_SRAM_BANK_X("analog_microphone");
 volatile int samples_read = 0;
 
 void on_analog_samples_ready()
@@ -52,7 +56,7 @@ int main( void )
     printf("hello analog microphone\n");
 
     // initialize the analog microphone
-    if (analog_microphone_init(&config) < 0) {
+    if (analog_microphone_init_static(&config, raw_buffers, NULL) < 0) {
         printf("analog microphone initialization failed!\n");
         while (1) { tight_loop_contents(); }
     }
@@ -24,6 +24,8 @@ const struct pdm_microphone_config config0 = {
   .pio_sm = 0,
   .sample_rate = SAMPLE_RATE,
   .sample_buffer_size = SAMPLE_BUFFER_SIZE,
+  // frames queued for the USB host, which polls on its own clock
+  .raw_buffer_count = 4,
 };
 
 const struct pdm_microphone_config config1 = {
@@ -44,18 +46,13 @@ const struct pdm_microphone_config config2 = {
   .sample_buffer_size = SAMPLE_BUFFER_SIZE,
 };
 
-// variables
-uint16_t sample_buffer[SAMPLE_BUFFER_SIZE];
-
 // callback functions
-void on_pdm_samples_ready();
 void on_usb_microphone_tx_ready();
 
 int main(void)
 {
   // initialize and start the PDM microphone
   pdm_microphone_init(&config0);
-  pdm_microphone_set_samples_ready_handler(on_pdm_samples_ready);
   pdm_microphone_start();
 
   // initialize the USB microphone interface
@@ -70,20 +67,37 @@ int main(void)
   return 0;
 }
 
-void on_pdm_samples_ready()
-{
-  // Callback from library when all the samples in the library
-  // internal sample buffer are ready for reading.
-  //
-  // Read new samples into local buffer.
-  pdm_microphone_read(sample_buffer, SAMPLE_BUFFER_SIZE);
-}
-
 void on_usb_microphone_tx_ready()
 {
   // Callback from TinyUSB library when all data is ready
   // to be transmitted.
   //
-  // Write local buffer to the USB microphone
-  usb_microphone_write(sample_buffer, sizeof(sample_buffer));
+  // Decode a frame of samples straight into the USB microphone
+  // FIFO, in two parts where it wraps around. When there are no
+  // samples yet or no space in the FIFO nothing is written, and
+  // the next callback tries again.
+  size_t written = 0;
+
+  while (written < SAMPLE_BUFFER_SIZE) {
+    uint16_t len;
+    int16_t* fifo = usb_microphone_write_acquire(&len);
+    size_t samples = len / sizeof(int16_t);
+
+    if (samples > SAMPLE_BUFFER_SIZE - written) {
+      samples = SAMPLE_BUFFER_SIZE - written;
+    }
+
+    if (samples == 0) {
+      break;
+    }
+
+    int samples_read = pdm_microphone_read(fifo, samples);
+
+    if (samples_read == 0) {
+      break;
+    }
+
+    usb_microphone_write_commit(samples_read * sizeof(int16_t));
+    written += samples_read;
+  }
 }
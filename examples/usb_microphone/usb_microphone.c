@@ -63,6 +63,23 @@ uint16_t usb_microphone_write(const void * data, uint16_t len)
   return tud_audio_write ((uint8_t *)data, len);
 }
 
+void * usb_microphone_write_acquire(uint16_t * len)
+{
+  tu_fifo_buffer_info_t info;
+
+  // the free space of the IN FIFO up to where it wraps around
+  tu_fifo_get_write_info(tud_audio_get_ep_in_ff(), &info);
+
+  *len = info.len_lin;
+
+  return info.ptr_lin;
+}
+
+void usb_microphone_write_commit(uint16_t len)
+{
+  tu_fifo_advance_write_pointer(tud_audio_get_ep_in_ff(), len);
+}
+
 void usb_microphone_task()
 {
   tud_task();
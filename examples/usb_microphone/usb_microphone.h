@@ -25,4 +25,9 @@ void usb_microphone_set_tx_ready_handler(usb_microphone_tx_ready_handler_t handl
 void usb_microphone_task();
 uint16_t usb_microphone_write(const void * data, uint16_t len);
 
+// writes in place into the USB FIFO: up to len bytes at the returned
+// address, then commit the bytes written
+void * usb_microphone_write_acquire(uint16_t * len);
+void usb_microphone_write_commit(uint16_t len);
+
 #endif
@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * The PDM and analog drivers running on the simulated HAL: captures a tone
+ * for every raw buffer count and injected DMA IRQ latency with a reader
+ * that stalls now and then, and reports the overruns, drops, FIFO
+ * overflows and the latency from a sample being taken to it being read.
+ *
+ *   microphone_sim_bench [speed] [PDM input file]
+ *
+ * The file holds the bit stream of a mono microphone clocked at 1.024 MHz,
+ * first bit in the top bit of a byte, by default a generated 1 kHz tone is
+ * used.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pico/analog_microphone.h"
+#include "pico/pdm_microphone.h"
+
+#define SAMPLE_RATE     16000
+#define BUFFER_SAMPLES  256
+#define RUN_US          2000000
+// the reader polls every POLL_US and stalls STALL_US every STALL_PERIOD_US
+#define POLL_US         1000
+#define STALL_US        40000
+#define STALL_PERIOD_US 500000
+#define TONE_HZ         1000
+#define TONE_PERIODS    16
+
+static const uint raw_buffer_counts[] = { 2, 4, 8 };
+
+static const struct {
+    uint32_t min_us;
+    uint32_t max_us;
+} irq_latencies[] = {
+    { 0, 20 },
+    { 200, 1000 },
+    { 2000, 6000 },
+};
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+struct result {
+    uint32_t captured;
+    uint32_t overruns;
+    uint32_t dropped;
+    uint32_t isr_latency_avg_us;
+    uint32_t isr_latency_max_us;
+    double latency_avg_ms;
+    double latency_max_ms;
+    double load;
+};
+
+typedef int (*read_fn)(int16_t* buffer, size_t samples);
+typedef uint32_t (*dropped_fn)();
+
+static struct pdm_microphone pdm_mic;
+
+static int pdm_read(int16_t* buffer, size_t samples) {
+    return pdm_mic_read(&pdm_mic, buffer, samples);
+}
+
+static uint32_t pdm_dropped() {
+    return pdm_mic_get_dropped_buffers(&pdm_mic);
+}
+
+static uint64_t host_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Reads for RUN_US from start_us. A sample is taken when the source has
+// clocked in all of it, every dropped buffer and transfer lost to a full
+// FIFO moves the stream on.
+static void run_reader(read_fn read, dropped_fn dropped, double samples_per_transfer, uint64_t start_us,
+                       struct result* result) {
+    static int16_t samples[BUFFER_SAMPLES * PDM_MICROPHONE_RAW_BUFFER_COUNT_MAX];
+    struct mic_hal_sim_stats start_stats, stats;
+
+    uint64_t read_samples = 0;
+    uint64_t next_stall_us = start_us + STALL_PERIOD_US;
+    uint64_t busy_ns = 0;
+    uint64_t host_start_ns = host_ns();
+    double latency_sum = 0;
+    uint32_t latency_count = 0;
+
+    result->latency_max_ms = 0;
+
+    mic_hal_sim_get_stats(&start_stats);
+
+    for (uint64_t now_us = start_us; now_us < start_us + RUN_US; now_us = mic_hal_sim_time_us()) {
+        uint64_t read_start_ns = host_ns();
+        int count = read(samples, COUNT_OF(samples));
+
+        busy_ns += host_ns() - read_start_ns;
+
+        if (count > 0) {
+            read_samples += count;
+
+            mic_hal_sim_get_stats(&stats);
+
+            double stream = read_samples + (double)dropped() * BUFFER_SAMPLES +
+                            (stats.fifo_overflows - start_stats.fifo_overflows) * samples_per_transfer;
+            double taken_us = start_us + stream * 1e6 / SAMPLE_RATE;
+            double latency_ms = (mic_hal_sim_time_us() - taken_us) / 1000;
+
+            latency_sum += latency_ms;
+            latency_count++;
+
+            if (latency_ms > result->latency_max_ms) {
+                result->latency_max_ms = latency_ms;
+            }
+        }
+
+        if (now_us >= next_stall_us) {
+            next_stall_us += STALL_PERIOD_US;
+
+            mic_hal_sim_sleep_us(STALL_US);
+        } else {
+            mic_hal_sim_sleep_us(POLL_US);
+        }
+    }
+
+    result->latency_avg_ms = latency_count ? (latency_sum / latency_count) : 0;
+    result->load = (double)busy_ns / (host_ns() - host_start_ns);
+}
+
+static int run_pdm(uint raw_buffer_count, struct result* result) {
+    const struct pdm_microphone_config config = {
+        .gpio_data = 2,
+        .gpio_clk = 3,
+        .pio = pio0,
+        .pio_sm = 0,
+        .sample_rate = SAMPLE_RATE,
+        .sample_buffer_size = BUFFER_SAMPLES,
+        .channels = 1,
+        .data_pins = 1,
+        .raw_buffer_count = raw_buffer_count,
+    };
+    struct pdm_microphone_stats stats;
+
+    if (pdm_mic_init(&pdm_mic, &config) < 0 || pdm_mic_start(&pdm_mic) < 0) {
+        return -1;
+    }
+
+    // a transfer holds 8 or 32 bits of the microphone
+    run_reader(pdm_read, pdm_dropped, (PDM_MICROPHONE_PUSH_32 ? 32.0 : 8.0) / PDM_DECIMATION, mic_hal_sim_time_us(), result);
+
+    pdm_mic_get_stats(&pdm_mic, &stats);
+
+    pdm_mic_stop(&pdm_mic);
+    pdm_mic_deinit(&pdm_mic);
+
+    result->captured = stats.buffers_captured;
+    result->overruns = stats.overruns;
+    result->dropped = stats.dropped_buffers;
+    result->isr_latency_avg_us = stats.isr_latency_avg_us;
+    result->isr_latency_max_us = stats.isr_latency_max_us;
+
+    return 0;
+}
+
+static int run_analog(uint raw_buffer_count, struct result* result) {
+    const struct analog_microphone_config config = {
+        .gpio = 26,
+        .bias_voltage = 1.25,
+        .sample_rate = SAMPLE_RATE,
+        .sample_buffer_size = BUFFER_SAMPLES,
+        .raw_buffer_count = raw_buffer_count,
+    };
+    struct analog_microphone_stats stats;
+
+    if (analog_microphone_init(&config) < 0 || analog_microphone_start() < 0) {
+        return -1;
+    }
+
+    run_reader(analog_microphone_read, analog_microphone_get_dropped_buffers, 1, mic_hal_sim_time_us(), result);
+
+    analog_microphone_get_stats(&stats);
+
+    analog_microphone_stop();
+    analog_microphone_deinit();
+
+    result->captured = stats.buffers_captured;
+    result->overruns = stats.overruns;
+    result->dropped = stats.dropped_buffers;
+    result->isr_latency_avg_us = stats.isr_latency_avg_us;
+    result->isr_latency_max_us = stats.isr_latency_max_us;
+
+    return 0;
+}
+
+// first-order sigma-delta modulation of a half scale tone, the bit stream of
+// a mono microphone: first bit in the top bit of a byte
+static uint8_t* generate_pdm(size_t* size) {
+    uint bits = TONE_PERIODS * (SAMPLE_RATE * PDM_DECIMATION / TONE_HZ);
+    uint8_t* data = malloc(bits / 8);
+    double integrator = 0;
+
+    for (uint i = 0; i < bits; i++) {
+        double x = 0.5 * sin(2 * M_PI * TONE_HZ * i / (SAMPLE_RATE * PDM_DECIMATION));
+        int bit = integrator >= 0;
+
+        integrator += x - (bit ? 1 : -1);
+
+        data[i / 8] = (data[i / 8] << 1) | bit;
+    }
+
+    *size = bits / 8;
+
+    return data;
+}
+
+static uint16_t* generate_adc(size_t* size) {
+    uint samples = TONE_PERIODS * (SAMPLE_RATE / TONE_HZ);
+    uint16_t* data = malloc(samples * sizeof(data[0]));
+
+    for (uint i = 0; i < samples; i++) {
+        data[i] = 1551 + 1000 * sin(2 * M_PI * TONE_HZ * i / SAMPLE_RATE);
+    }
+
+    *size = samples * sizeof(data[0]);
+
+    return data;
+}
+
+int main(int argc, char* argv[]) {
+    double speed = (argc > 1) ? atof(argv[1]) : 10;
+    uint8_t* pdm_data = NULL;
+    size_t pdm_size;
+    size_t adc_size;
+    uint16_t* adc_data = generate_adc(&adc_size);
+
+    if (argc > 2) {
+        if (mic_hal_sim_load_pdm_input(pio0, 0, argv[2], true) < 0) {
+            fprintf(stderr, "cannot read %s\n", argv[2]);
+            return 1;
+        }
+    } else {
+        pdm_data = generate_pdm(&pdm_size);
+
+        mic_hal_sim_set_pdm_input(pio0, 0, pdm_data, pdm_size, true);
+    }
+
+    mic_hal_sim_set_adc_input(adc_data, adc_size, true);
+    mic_hal_sim_set_speed(speed > 0 ? speed : 1);
+
+    printf("%d Hz, %d sample buffers, %s DMA, reader stalling %d ms every %d ms, %.0fx real time\n\n",
+           SAMPLE_RATE, BUFFER_SAMPLES, PDM_MICROPHONE_CHAINED_DMA ? "chained" : "restarted",
+           STALL_US / 1000, STALL_PERIOD_US / 1000, speed);
+    printf("%-6s %4s %11s %8s %8s %7s %7s %8s %14s %14s %6s\n",
+           "mic", "bufs", "irq us", "captured", "overruns", "dropped", "merged", "fifo ovf",
+           "isr avg/max us", "e2e avg/max ms", "load");
+
+    for (uint mic = 0; mic < 2; mic++) {
+        for (uint b = 0; b < COUNT_OF(raw_buffer_counts); b++) {
+            for (uint l = 0; l < COUNT_OF(irq_latencies); l++) {
+                struct mic_hal_sim_stats before, after;
+                struct result result;
+                char latency[16];
+
+                mic_hal_sim_set_irq_latency(irq_latencies[l].min_us, irq_latencies[l].max_us, 1 + l);
+                mic_hal_sim_get_stats(&before);
+
+                int status = mic ? run_analog(raw_buffer_counts[b], &result) : run_pdm(raw_buffer_counts[b], &result);
+
+                if (status < 0) {
+                    fprintf(stderr, "%s microphone did not start\n", mic ? "analog" : "pdm");
+                    return 1;
+                }
+
+                mic_hal_sim_get_stats(&after);
+
+                snprintf(latency, sizeof(latency), "%u-%u", irq_latencies[l].min_us, irq_latencies[l].max_us);
+
+                printf("%-6s %4u %11s %8u %8u %7u %7u %8u %6u / %-6u %6.1f / %-6.1f %5.1f%%\n",
+                       mic ? "analog" : "pdm", raw_buffer_counts[b], latency,
+                       result.captured, result.overruns, result.dropped,
+                       after.irqs_merged - before.irqs_merged, after.fifo_overflows - before.fifo_overflows,
+                       result.isr_latency_avg_us, result.isr_latency_max_us,
+                       result.latency_avg_ms, result.latency_max_ms, result.load * 100);
+            }
+        }
+    }
+
+    mic_hal_sim_shutdown();
+
+    free(pdm_data);
+    free(adc_data);
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * pcm_ring with a producer and a consumer thread: the producer writes a
+ * running sample count in pieces of random sizes, copying or in place, and
+ * the consumer reads it back with every read call, checking that no sample
+ * is lost, repeated or reordered. A small ring keeps both sides wrapping
+ * around and waiting on each other. Exits with 1 on a mismatch, the host
+ * build runs it.
+ *
+ *   pcm_ring_stress [samples]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pico/pcm_ring.h"
+
+#define RING_SIZE       64
+#define PIECE_MAX       (RING_SIZE + RING_SIZE / 2)
+#define DEFAULT_SAMPLES 2000000u
+
+static struct pcm_ring ring;
+static int16_t ring_buffer[RING_SIZE];
+static uint32_t total_samples = DEFAULT_SAMPLES;
+
+// each thread has its own generator, rand() is not thread safe
+static uint32_t next_random(uint32_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+
+    return *state;
+}
+
+static void* producer(void* arg) {
+    uint32_t random = 1;
+    uint32_t sent = 0;
+
+    (void) arg;
+
+    while (sent < total_samples) {
+        uint32_t piece = next_random(&random) % PIECE_MAX + 1;
+
+        if (piece > total_samples - sent) {
+            piece = total_samples - sent;
+        }
+
+        if (piece & 1) {
+            int16_t samples[PIECE_MAX];
+            size_t written;
+
+            for (uint32_t i = 0; i < piece; i++) {
+                samples[i] = (int16_t) (sent + i);
+            }
+
+            written = pcm_ring_write(&ring, samples, piece);
+
+            if (written == 0) {
+                sched_yield();
+            }
+
+            sent += written;
+        } else {
+            size_t count;
+            int16_t* samples = pcm_ring_write_acquire(&ring, &count);
+
+            if (count > piece) {
+                count = piece;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                samples[i] = (int16_t) (sent + i);
+            }
+
+            if (count == 0) {
+                sched_yield();
+            }
+
+            pcm_ring_write_commit(&ring, count);
+            sent += count;
+        }
+    }
+
+    return NULL;
+}
+
+static uint32_t check(const int16_t* samples, size_t count, uint32_t received, uint32_t* mismatches) {
+    for (size_t i = 0; i < count; i++) {
+        if (samples[i] != (int16_t) (received + i)) {
+            (*mismatches)++;
+        }
+    }
+
+    return received + count;
+}
+
+int main(int argc, char** argv) {
+    uint32_t random = 2;
+    uint32_t received = 0;
+    uint32_t mismatches = 0;
+    uint32_t calls[4] = { 0 };
+    pthread_t thread;
+
+    if (argc > 1) {
+        total_samples = strtoul(argv[1], NULL, 0);
+    }
+
+    if (pcm_ring_init(&ring, ring_buffer, RING_SIZE) < 0) {
+        printf("pcm_ring_init failed\n");
+
+        return 1;
+    }
+
+    if (pthread_create(&thread, NULL, producer, NULL) != 0) {
+        printf("pthread_create failed\n");
+
+        return 1;
+    }
+
+    while (received < total_samples) {
+        uint32_t piece = next_random(&random) % PIECE_MAX + 1;
+        unsigned call = next_random(&random) % 4;
+        int16_t samples[PIECE_MAX];
+        uint32_t before = received;
+
+        if (piece > total_samples - received) {
+            piece = total_samples - received;
+        }
+
+        switch (call) {
+        case 0:
+            received = check(samples, pcm_ring_read(&ring, samples, piece), received, &mismatches);
+            break;
+
+        case 1:
+            if (pcm_ring_read_exact(&ring, samples, piece)) {
+                received = check(samples, piece, received, &mismatches);
+            }
+            break;
+
+        case 2:
+            received = check(samples, pcm_ring_read_blocking(&ring, samples, piece), received, &mismatches);
+            break;
+
+        default: {
+            size_t count;
+            const int16_t* queued = pcm_ring_read_acquire(&ring, &count);
+
+            if (count > piece) {
+                count = piece;
+            }
+
+            received = check(queued, count, received, &mismatches);
+            pcm_ring_read_release(&ring, count);
+            break;
+        }
+        }
+
+        // the other thread may need this core to catch up
+        if (received == before) {
+            sched_yield();
+        }
+
+        calls[call]++;
+    }
+
+    pthread_join(thread, NULL);
+
+    printf("%u samples through a ring of %u, %u read, %u read_exact, %u read_blocking, %u read_acquire calls\n",
+        total_samples, RING_SIZE, calls[0], calls[1], calls[2], calls[3]);
+
+    if (mismatches || pcm_ring_available(&ring)) {
+        printf("\n%u samples out of sequence, %u left in the ring\n", mismatches, (unsigned) pcm_ring_available(&ring));
+
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Host benchmark for the decode loop of pdm_mic_read(): transposition of the
+ * raw state machine data and the filter of every channel, for each
+ * decimation, channel count and raw buffer size, then the channels one core
+ * decodes at the high sample rates.
+ *
+ *   pdm_decode_bench [host GHz] [RP2040 cycles per host cycle]
+ *
+ * The RP2040 estimate scales host cycles by the given ratio, calibrate it
+ * once against the frame_cycles_avg of pdm_mic_get_stats() on a device.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pdm_microphone_decode.h"
+
+#define SAMPLE_RATE     16000
+#define MAX_CHANNELS    8
+#define MIN_RUN_NS      50000000ull
+#define RP2040_HZ       125000000.0
+
+static const unsigned decimations[] = { 16, 32, 48, 64, 128 };
+static const unsigned channel_counts[] = { 1, 2, 4, 8 };
+static const unsigned buffer_ms[] = { 1, 4, 16 };
+
+// high rate budget: 4 ms raw buffers decoded a millisecond or a whole buffer
+// per filter call, and the share of a core the decode may take
+static const unsigned high_rates[] = { 96000, 192000 };
+static const unsigned high_rate_decimations[] = { 16, 32 };
+#define HIGH_RATE_BUFFER_MS 4
+#define CORE_BUDGET         0.8
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint64_t time_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// the filter takes the same path whatever the bits are
+static void fill_raw(uint8_t* raw, size_t bytes) {
+    uint32_t x = 0x12345678;
+
+    for (size_t i = 0; i < bytes; i++) {
+        x = x * 1664525 + 1013904223;
+        raw[i] = x >> 24;
+    }
+}
+
+// the filter of every channel, -1 when it does not support the configuration
+static int init_filters(TPDMFilter_InitStruct* filter, unsigned* channel_offset, unsigned sample_rate, unsigned decimation, unsigned channels, unsigned frame_samples) {
+    memset(filter, 0x00, sizeof(filter[0]) * channels);
+
+    for (unsigned i = 0; i < channels; i++) {
+        channel_offset[i] = i;
+
+        filter[i].Fs = sample_rate;
+        filter[i].FrameSamples = frame_samples;
+        filter[i].LP_HZ = sample_rate / 2;
+        filter[i].HP_HZ = 10;
+        filter[i].In_MicChannels = channels;
+        filter[i].Out_MicChannels = channels;
+        filter[i].Decimation = decimation;
+        filter[i].MaxVolume = 64;
+        filter[i].Gain = 16;
+
+        if (Open_PDM_Filter_Init(&filter[i]) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// ns per output sample, or a negative value when the filter does not
+// support the configuration. frame_samples of every channel per filter call,
+// 0 for a millisecond.
+static double run(unsigned sample_rate, unsigned decimation, unsigned channels, unsigned ms, unsigned frame_samples) {
+    TPDMFilter_InitStruct filter[MAX_CHANNELS];
+    unsigned channel_offset[MAX_CHANNELS];
+
+    size_t samples = ms * (sample_rate / 1000) * channels;
+    size_t raw_bytes = samples * (decimation / 8);
+    uint8_t* raw = malloc(raw_bytes);
+    int16_t* out = malloc(samples * sizeof(out[0]));
+
+    fill_raw(raw, raw_bytes);
+
+    if (init_filters(filter, channel_offset, sample_rate, decimation, channels, frame_samples) < 0) {
+        free(raw);
+        free(out);
+
+        return -1;
+    }
+
+    uint64_t buffers = 0;
+    uint64_t start = time_ns();
+    uint64_t elapsed;
+
+    // transposing again only permutes the bits, which the timing ignores
+    do {
+        pdm_decode(filter, channel_offset, channels, decimation, 64, raw, out, samples);
+
+        buffers++;
+        elapsed = time_ns() - start;
+    } while (elapsed < MIN_RUN_NS);
+
+    free(raw);
+    free(out);
+
+    return (double)elapsed / (buffers * samples);
+}
+
+int main(int argc, char* argv[]) {
+    double host_ghz = (argc > 1) ? atof(argv[1]) : 3.0;
+    double rp2040_ratio = (argc > 2) ? atof(argv[2]) : 4.0;
+
+    printf("sinc order %d, %d Hz, host %.2f GHz, %.2f RP2040 cycles per host cycle\n\n", SINCN, SAMPLE_RATE, host_ghz, rp2040_ratio);
+    printf("decimation  channels  buffer ms  ns/sample  Msamples/s  RP2040 cycles/sample  RP2040 load\n");
+
+    for (unsigned d = 0; d < COUNT_OF(decimations); d++) {
+        if (decimations[d] > DECIMATION_MAX) {
+            continue;
+        }
+
+        for (unsigned c = 0; c < COUNT_OF(channel_counts); c++) {
+            for (unsigned m = 0; m < COUNT_OF(buffer_ms); m++) {
+                double ns = run(SAMPLE_RATE, decimations[d], channel_counts[c], buffer_ms[m], 0);
+
+                if (ns < 0) {
+                    continue;
+                }
+
+                double rp2040_cycles = ns * host_ghz * rp2040_ratio;
+
+                // at 125 MHz for every channel at SAMPLE_RATE
+                double load = rp2040_cycles * SAMPLE_RATE * channel_counts[c] / RP2040_HZ;
+
+                printf("%10u  %8u  %9u  %9.1f  %10.2f  %20.0f  %10.1f%%\n",
+                    decimations[d], channel_counts[c], buffer_ms[m],
+                    ns, 1000.0 / ns, rp2040_cycles, load * 100);
+            }
+        }
+    }
+
+    printf("\nhigh rates, %d ms buffers, %.0f%% of a core: RP2040 load per channel count\n", HIGH_RATE_BUFFER_MS, CORE_BUDGET * 100);
+    printf("  rate  decimation  frame    1 ch    2 ch    4 ch    8 ch  channels/core\n");
+
+    for (unsigned r = 0; r < COUNT_OF(high_rates); r++) {
+        for (unsigned d = 0; d < COUNT_OF(high_rate_decimations); d++) {
+            for (unsigned whole = 0; whole < 2; whole++) {
+                unsigned rate = high_rates[r];
+                unsigned frame = whole ? HIGH_RATE_BUFFER_MS * (rate / 1000) : 0;
+                unsigned fit = 0;
+
+                if (high_rate_decimations[d] > DECIMATION_MAX) {
+                    continue;
+                }
+
+                printf("%6u  %10u  %5s", rate, high_rate_decimations[d], whole ? "4 ms" : "1 ms");
+
+                for (unsigned c = 0; c < COUNT_OF(channel_counts); c++) {
+                    double ns = run(rate, high_rate_decimations[d], channel_counts[c], HIGH_RATE_BUFFER_MS, frame);
+                    double load = ns * host_ghz * rp2040_ratio * rate * channel_counts[c] / RP2040_HZ;
+
+                    if (load <= CORE_BUDGET) {
+                        fit = channel_counts[c];
+                    }
+
+                    printf("  %5.0f%%", load * 100);
+                }
+
+                printf("  %13u\n", fit);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ * 
+ * Host benchmark for the OpenPDM2PCM filter: reports the Look-Up Table
+ * size, the time Open_PDM_Filter_Init() takes and the time spent per
+ * output sample for each decimation, for the SINCN the bench is built with.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "OpenPDM2PCM/OpenPDMFilter.h"
+
+#define SAMPLE_RATE    16000
+#define BLOCKS         20000
+#define PDM_BLOCKS     1000
+
+static uint64_t time_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 1 kHz sine through a first order sigma-delta modulator
+static void generate_pdm(uint8_t* pdm, size_t bytes, int decimation) {
+    double integrator = 0;
+    double phase_inc = 2 * M_PI * 1000 / (SAMPLE_RATE * (double)decimation);
+
+    for (size_t i = 0; i < bytes; i++) {
+        uint8_t byte = 0;
+
+        for (int bit = 0; bit < 8; bit++) {
+            double x = 0.5 * sin(phase_inc * (i * 8 + bit));
+            int out = integrator >= 0;
+
+            integrator += x - (out ? 1.0 : -1.0);
+            byte = (byte << 1) | out;
+        }
+
+        pdm[i] = byte;
+    }
+}
+
+#define DATAPATH_INT64   0
+#define DATAPATH_FIXED32 1
+
+#ifdef USE_HALFBAND
+#define HALFBAND_STAGES_MAX 2
+#else
+#define HALFBAND_STAGES_MAX 0
+#endif
+
+// the generated table of a sinc decimation, or without generated tables one
+// built here: the library default table only serves one decimation
+static const TPDMFilter_Table* table_for(int decimation) {
+#ifdef USE_GENERATED_TABLES
+    return Open_PDM_Filter_Get_Table(decimation);
+#else
+    // no filter holds it across calls
+    static TPDMFilter_Table table;
+#ifdef USE_LUT
+    static TPDMFilter_LUT_Entry lut[DECIMATION_MAX / 8][256][SINCN];
+
+    if (Open_PDM_Filter_Table_Init(&table, decimation, lut) < 0) {
+#else
+    if (Open_PDM_Filter_Table_Init(&table, decimation, 0) < 0) {
+#endif
+        return NULL;
+    }
+
+    return &table;
+#endif
+}
+
+// decodes BLOCKS calls worth of samples into out, returns -1 when the
+// datapath or half-band stages are not available for the decimation
+static int run(int decimation, int stages, int datapath, uint16_t volume, int16_t* out, uint64_t* init_ns, uint64_t* run_ns) {
+    TPDMFilter_InitStruct filter;
+
+#ifndef USE_HALFBAND
+    // built without half-band stages
+    if (stages) {
+        return -1;
+    }
+#endif
+
+    int samples_per_call = SAMPLE_RATE / 1000;
+    size_t block_bytes = samples_per_call * (decimation / 8);
+    uint8_t* pdm = malloc(block_bytes * PDM_BLOCKS);
+
+    generate_pdm(pdm, block_bytes * PDM_BLOCKS, decimation);
+
+    memset(&filter, 0x00, sizeof(filter));
+    filter.Fs = SAMPLE_RATE;
+    filter.LP_HZ = SAMPLE_RATE / 2;
+    filter.HP_HZ = 10;
+    filter.In_MicChannels = 1;
+    filter.Out_MicChannels = 1;
+    filter.Decimation = decimation;
+    filter.MaxVolume = 64;
+    filter.Gain = 16;
+#ifdef USE_HALFBAND
+    filter.HalfBandStages = stages;
+#endif
+
+    uint64_t start = time_ns();
+
+    filter.Table = table_for(decimation >> stages);
+
+    if (filter.Table == NULL || Open_PDM_Filter_Init(&filter) < 0) {
+        free(pdm);
+
+        return -1;
+    }
+
+    *init_ns = time_ns() - start;
+
+#ifdef USE_FIXED32
+    if (datapath == DATAPATH_FIXED32 && !filter.Fixed32) {
+        free(pdm);
+
+        return -1;
+    }
+
+    filter.Fixed32 = (datapath == DATAPATH_FIXED32);
+#else
+    if (datapath == DATAPATH_FIXED32) {
+        free(pdm);
+
+        return -1;
+    }
+#endif
+
+    start = time_ns();
+
+    for (int i = 0; i < BLOCKS; i++) {
+        uint8_t* in = pdm + (i % PDM_BLOCKS) * block_bytes;
+
+        Open_PDM_Filter(in, (uint16_t*)out, volume, &filter);
+
+        out += samples_per_call;
+    }
+
+    *run_ns = time_ns() - start;
+
+    free(pdm);
+
+    return 0;
+}
+
+static const char* datapath_names[] = { "int64", "fixed32" };
+
+static void benchmark(int decimation, int16_t* out) {
+    for (int stages = 0; stages <= HALFBAND_STAGES_MAX; stages++) {
+        for (int datapath = DATAPATH_INT64; datapath <= DATAPATH_FIXED32; datapath++) {
+            uint64_t init_ns;
+            uint64_t run_ns;
+
+            if (run(decimation, stages, datapath, 64, out, &init_ns, &run_ns) < 0) {
+                continue;
+            }
+
+            printf("%10d %10d %10s %10s %10zu %10zu %10.1f %12.2f\n",
+                decimation,
+                stages,
+#ifdef USE_GENERATED_TABLES
+                "generated",
+#else
+                "runtime",
+#endif
+                datapath_names[datapath],
+                sizeof(TPDMFilter_LUT_Entry),
+                (decimation >> stages) / 8 * 256 * SINCN * sizeof(TPDMFilter_LUT_Entry),
+                init_ns / 1000.0,
+                (double)run_ns / ((double)BLOCKS * (SAMPLE_RATE / 1000))
+            );
+        }
+    }
+}
+
+// compares the fixed32 datapath against the int64 one on the same input
+static void compare(int decimation, uint16_t volume, int16_t* ref, int16_t* out) {
+    uint64_t init_ns;
+    uint64_t run_ns;
+    size_t samples = (size_t)BLOCKS * (SAMPLE_RATE / 1000);
+
+    if (run(decimation, 0, DATAPATH_INT64, volume, ref, &init_ns, &run_ns) < 0 ||
+        run(decimation, 0, DATAPATH_FIXED32, volume, out, &init_ns, &run_ns) < 0) {
+        return;
+    }
+
+    double signal = 0;
+    double noise = 0;
+    int max_error = 0;
+    size_t exact = 0;
+
+    for (size_t i = 0; i < samples; i++) {
+        int error = abs(out[i] - ref[i]);
+
+        signal += (double)ref[i] * ref[i];
+        noise += (double)error * error;
+
+        if (error > max_error) {
+            max_error = error;
+        }
+
+        if (error == 0) {
+            exact++;
+        }
+    }
+
+    printf("%10d %10u %10d %9.3f%% %10.1f\n",
+        decimation,
+        volume,
+        max_error,
+        100.0 * exact / samples,
+        noise == 0 ? INFINITY : 10 * log10(signal / noise)
+    );
+}
+
+// checks the reciprocal volume scaling against RoundDiv for every OldZ up to
+// Limit: beyond it the output saturates or OldZ cannot reach
+static void check_scaling(int decimation, uint8_t max_volume, uint8_t gain, uint16_t volume) {
+    TPDMFilter_InitStruct filter;
+    uint8_t pdm[(SAMPLE_RATE / 1000) * (128 / 8)] = { 0 };
+    uint16_t out[SAMPLE_RATE / 1000];
+
+    memset(&filter, 0x00, sizeof(filter));
+    filter.Fs = SAMPLE_RATE;
+    filter.Decimation = decimation;
+    filter.In_MicChannels = 1;
+    filter.MaxVolume = max_volume;
+    filter.Gain = gain;
+    filter.Table = table_for(decimation);
+
+    if (filter.Table == NULL || Open_PDM_Filter_Init(&filter) < 0) {
+        return;
+    }
+
+    // updates the scaling for the volume
+    Open_PDM_Filter(pdm, out, volume, &filter);
+
+    int64_t div = filter.DivConst;
+    int64_t limit = filter.Limit;
+    int64_t round = ((int64_t)1 << filter.ScaleShift) >> 1;
+    int64_t mismatches = 0;
+    int64_t max_error = 0;
+#ifdef USE_FIXED32
+    int32_t round32 = (1 << filter.ScaleShift32) >> 1;
+    int64_t mismatches32 = 0;
+    int64_t max_error32 = 0;
+#endif
+
+    for (int64_t z = -limit; z <= limit; z++) {
+        int64_t exact = RoundDiv(z * volume, div);
+        exact = SaturaLH(exact, -32700, 32700);
+
+        int64_t clamped = SaturaLH(z, -limit, limit);
+        int64_t scaled = RoundMulShift(clamped, (int64_t)filter.ScaleMul, filter.ScaleShift, round);
+        scaled = SaturaLH(scaled, -32700, 32700);
+
+        if (scaled != exact) {
+            mismatches++;
+            max_error = llabs(scaled - exact) > max_error ? llabs(scaled - exact) : max_error;
+        }
+
+#ifdef USE_FIXED32
+        int32_t scaled32 = RoundMulShift((int32_t)clamped, filter.ScaleMul32, filter.ScaleShift32, round32);
+        scaled32 = SaturaLH(scaled32, -32700, 32700);
+
+        if (scaled32 != exact) {
+            mismatches32++;
+            max_error32 = llabs(scaled32 - exact) > max_error32 ? llabs(scaled32 - exact) : max_error32;
+        }
+#endif
+    }
+
+    printf("%10d %10u %10lld %10lld %10lld",
+        decimation,
+        volume,
+        (long long)div,
+        (long long)(2 * limit + 1),
+        (long long)mismatches
+    );
+    printf(" %10lld", (long long)max_error);
+#ifdef USE_FIXED32
+    // the datapath is not used without the headroom
+    if (filter.Fixed32) {
+        printf(" %10lld %10lld", (long long)mismatches32, (long long)max_error32);
+    } else {
+        printf(" %10s %10s", "-", "-");
+    }
+#endif
+    printf("\n");
+}
+
+int main() {
+    int decimations[] = { 16, 32, 48, 64, 128 };
+    uint16_t volumes[] = { 1, 16, 64, 256, 4096 };
+    int16_t* ref = malloc(sizeof(int16_t) * BLOCKS * (SAMPLE_RATE / 1000));
+    int16_t* out = malloc(sizeof(int16_t) * BLOCKS * (SAMPLE_RATE / 1000));
+
+    printf("sinc order %d\n\n", SINCN);
+    printf("%10s %10s %10s %10s %10s %10s %10s %12s\n", "decimation", "halfband", "tables", "datapath", "entry", "lut bytes", "init us", "ns/sample");
+
+    for (size_t i = 0; i < sizeof(decimations) / sizeof(decimations[0]); i++) {
+        if (decimations[i] > DECIMATION_MAX) {
+            continue;
+        }
+
+        benchmark(decimations[i], out);
+    }
+
+    printf("\nreciprocal scaling vs RoundDiv\n");
+    printf("%10s %10s %10s %10s %10s %10s", "decimation", "volume", "div", "values", "int64 diff", "max error");
+#ifdef USE_FIXED32
+    printf(" %10s %10s", "fixed32", "max error");
+#endif
+    printf("\n");
+
+    for (size_t i = 0; i < sizeof(decimations) / sizeof(decimations[0]); i++) {
+        if (decimations[i] > DECIMATION_MAX) {
+            continue;
+        }
+
+        for (size_t j = 0; j < sizeof(volumes) / sizeof(volumes[0]); j++) {
+            check_scaling(decimations[i], 64, 16, volumes[j]);
+        }
+
+        // gains that make DivConst a non power of two
+        check_scaling(decimations[i], 100, 3, 100);
+        check_scaling(decimations[i], 255, 1, 7);
+        check_scaling(decimations[i], 255, 7, 1000);
+    }
+
+#ifdef USE_FIXED32
+    printf("\nfixed32 vs int64\n");
+    printf("%10s %10s %10s %10s %10s\n", "decimation", "volume", "max error", "exact", "snr dB");
+
+    for (size_t i = 0; i < sizeof(decimations) / sizeof(decimations[0]); i++) {
+        if (decimations[i] > DECIMATION_MAX) {
+            continue;
+        }
+
+        for (size_t j = 0; j < sizeof(volumes) / sizeof(volumes[0]); j++) {
+            compare(decimations[i], volumes[j], ref, out);
+        }
+    }
+#endif
+
+    free(ref);
+    free(out);
+
+    return 0;
+}
@@ -0,0 +1,609 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Audio quality regression suite for the PDM filter: test signals go through
+ * a reference 4th order sigma-delta modulator and Open_PDM_Filter_64/128,
+ * the output is measured and checked against minimum quality thresholds.
+ * Exits with 1 when a measurement is outside its threshold, the host build
+ * runs it so an optimization that lowers quality fails the build.
+ *
+ * Levels are relative to PDM full scale (all ones), the filter runs with a
+ * gain of 1 so that is also 16-bit full scale.
+ */
+
+#include <complex.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "OpenPDM2PCM/OpenPDMFilter.h"
+
+#define SAMPLE_RATE     16000
+// samples the high pass filter is left to settle, then measured: tones are
+// on a whole number of cycles of the measured samples, every 2 Hz
+#define SETTLE_SAMPLES  4000
+#define MEASURE_SAMPLES 8000
+#define TOTAL_SAMPLES   (SETTLE_SAMPLES + MEASURE_SAMPLES)
+
+#define SDM_ORDER       4
+// largest noise transfer function gain, lower is more stable, higher
+// shapes more noise out of the audio band
+#define SDM_NTF_GAIN    1.5
+
+#define TONE_LEVEL      0.5
+#define FULL_SCALE_LEVEL 0.6
+#define HARMONICS       5
+
+// exponential sine sweep over the measured samples, faded in and out, and
+// the passband it is measured over in points per octave
+#define SWEEP_START_HZ   25.0
+#define SWEEP_END_HZ     7500.0
+#define SWEEP_FADE_S     0.02
+#define PASSBAND_LOW_HZ  100.0
+#define PASSBAND_HIGH_HZ (0.25 * SAMPLE_RATE)
+#define SWEEP_OCTAVE_POINTS 12
+// log2(PASSBAND_HIGH_HZ / PASSBAND_LOW_HZ) octaves, and the top end
+#define SWEEP_POINTS     (5 * SWEEP_OCTAVE_POINTS + 5)
+
+// measured DC against the offset the filter rounding predicts, see
+// rounding_dc_lsb()
+#define DC_TOLERANCE_LSB 2.0
+
+#ifdef USE_HALFBAND
+#define HALFBAND_STAGES_MAX 2
+#else
+#define HALFBAND_STAGES_MAX 0
+#endif
+
+#ifdef USE_FIXED32
+#define FIXED32_MAX 1
+#else
+#define FIXED32_MAX 0
+#endif
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+/*
+ * Error feedback modulator with NTF(z) = (1 - z^-1)^4 / D(z): the
+ * quantization error is filtered by NTF - 1 and added to the input, so the
+ * output bits are the input plus the error shaped by the NTF. D(z) holds the
+ * poles of a Butterworth high pass through the bilinear transform, with the
+ * cut-off that gives the NTF a gain of SDM_NTF_GAIN at Nyquist.
+ */
+struct sdm {
+    double n[SDM_ORDER + 1];
+    double d[SDM_ORDER + 1];
+    // error filtered by 1 / D, newest first
+    double w[SDM_ORDER];
+    unsigned resets;
+};
+
+static void sdm_poles(double fc, double d[SDM_ORDER + 1]) {
+    double complex poly[SDM_ORDER + 1] = { 1 };
+    double wc = tan(M_PI * fc);
+
+    for (int k = 0; k < SDM_ORDER; k++) {
+        double complex s = cexp(I * M_PI * (2 * k + 1 + SDM_ORDER) / (2 * SDM_ORDER));
+        double complex z = (1 + wc / s) / (1 - wc / s);
+
+        // poly *= (1 - z z^-1)
+        for (int i = k + 1; i > 0; i--) {
+            poly[i] -= z * poly[i - 1];
+        }
+    }
+
+    for (int i = 0; i <= SDM_ORDER; i++) {
+        d[i] = creal(poly[i]);
+    }
+}
+
+static void sdm_init(struct sdm* sdm) {
+    double lo = 0;
+    double hi = 0.5;
+
+    memset(sdm, 0x00, sizeof(*sdm));
+
+    // (1 - z^-1)^4
+    for (int i = 0; i <= SDM_ORDER; i++) {
+        double c = 1;
+
+        for (int j = 0; j < i; j++) {
+            c = c * (SDM_ORDER - j) / (j + 1);
+        }
+
+        sdm->n[i] = (i & 1) ? -c : c;
+    }
+
+    // the gain at Nyquist, 2^4 / |D(-1)|, rises with the cut-off
+    for (int i = 0; i < 60; i++) {
+        double fc = (lo + hi) / 2;
+        double d_nyquist = 0;
+
+        sdm_poles(fc, sdm->d);
+
+        for (int j = 0; j <= SDM_ORDER; j++) {
+            d_nyquist += (j & 1) ? -sdm->d[j] : sdm->d[j];
+        }
+
+        if ((1 << SDM_ORDER) / fabs(d_nyquist) < SDM_NTF_GAIN) {
+            lo = fc;
+        } else {
+            hi = fc;
+        }
+    }
+
+    sdm_poles(lo, sdm->d);
+}
+
+static int sdm_bit(struct sdm* sdm, double u) {
+    double v = u;
+
+    for (int k = 1; k <= SDM_ORDER; k++) {
+        v += (sdm->n[k] - sdm->d[k]) * sdm->w[k - 1];
+    }
+
+    int bit = v >= 0;
+    double e = (bit ? 1.0 : -1.0) - v;
+
+    // unstable, which a stable input level never gets near
+    if (fabs(v) > 8) {
+        memset(sdm->w, 0x00, sizeof(sdm->w));
+        sdm->resets++;
+
+        return bit;
+    }
+
+    double w = e;
+
+    for (int k = 1; k <= SDM_ORDER; k++) {
+        w -= sdm->d[k] * sdm->w[k - 1];
+    }
+
+    memmove(sdm->w + 1, sdm->w, (SDM_ORDER - 1) * sizeof(sdm->w[0]));
+    sdm->w[0] = w;
+
+    return bit;
+}
+
+// the sweep at t seconds into the measured samples, silence outside them
+static double sweep(double t) {
+    double duration = (double)MEASURE_SAMPLES / SAMPLE_RATE;
+    double k = log(SWEEP_END_HZ / SWEEP_START_HZ);
+    double envelope = 1;
+
+    if (t < 0 || t >= duration) {
+        return 0;
+    }
+
+    if (t < SWEEP_FADE_S) {
+        envelope = 0.5 - 0.5 * cos(M_PI * t / SWEEP_FADE_S);
+    } else if (duration - t < SWEEP_FADE_S) {
+        envelope = 0.5 - 0.5 * cos(M_PI * (duration - t) / SWEEP_FADE_S);
+    }
+
+    return envelope * sin(2 * M_PI * SWEEP_START_HZ * duration / k * (exp(t * k / duration) - 1));
+}
+
+// a sine, the sweep, or silence at level 0, first bit MSB first like the PIO
+// program
+static void generate_pdm(struct sdm* sdm, uint8_t* pdm, unsigned decimation, double freq, double level, int is_sweep) {
+    double pdm_rate = (double)SAMPLE_RATE * decimation;
+    size_t bits = (size_t)TOTAL_SAMPLES * decimation;
+
+    for (size_t i = 0; i < bits; i++) {
+        double u = is_sweep ? level * sweep((double)i / pdm_rate - (double)SETTLE_SAMPLES / SAMPLE_RATE)
+                            : level * sin(2 * M_PI * freq * i / pdm_rate);
+
+        pdm[i / 8] = (pdm[i / 8] << 1) | sdm_bit(sdm, u);
+    }
+}
+
+struct config {
+    unsigned decimation;
+    unsigned stages;
+    int fixed32;
+};
+
+/*
+ * DC offset of the output in LSB predicted by the filter rounding. The high
+ * and low pass filters floor every result, -0.5 on average, which their
+ * feedback gains up to 128 / (256 - HP_ALFA) and 128 / LP_ALFA before the
+ * output scaling. The average only holds while noise dithers the rounding,
+ * a periodic tone with little noise (decimation 128 with half-band stages)
+ * lands about a LSB further out, hence DC_TOLERANCE_LSB.
+ *
+ * This is a known defect of the filter, which keeps the rounding of the
+ * original OpenPDM2PCM code, not its spec: the check is that the offset
+ * matches this term, so any other source of DC fails, not that the offset
+ * is acceptable.
+ */
+static double rounding_dc_lsb(const TPDMFilter_InitStruct* filter) {
+    double z = -128.0 / (256 - filter->HP_ALFA) - 128.0 / filter->LP_ALFA;
+
+    return z * filter->MaxVolume / filter->DivConst;
+}
+
+// measured samples of the filter output, or -1 when the configuration is not
+// available, and the offset the rounding predicts unless rounding_dc is NULL
+static int decode(const struct config* config, const uint8_t* pdm, int16_t* out, double* rounding_dc) {
+    TPDMFilter_InitStruct filter;
+    unsigned samples_per_call = SAMPLE_RATE / 1000;
+    unsigned bytes_per_call = samples_per_call * config->decimation / 8;
+    static int16_t pcm[TOTAL_SAMPLES];
+
+    memset(&filter, 0x00, sizeof(filter));
+    filter.Fs = SAMPLE_RATE;
+    filter.LP_HZ = SAMPLE_RATE / 2;
+    filter.HP_HZ = 10;
+    filter.In_MicChannels = 1;
+    filter.Out_MicChannels = 1;
+    filter.Decimation = config->decimation;
+    filter.MaxVolume = 64;
+    filter.Gain = 1;
+#ifdef USE_HALFBAND
+    filter.HalfBandStages = config->stages;
+#endif
+
+    if (Open_PDM_Filter_Init(&filter) < 0) {
+        return -1;
+    }
+
+#ifdef USE_FIXED32
+    if (config->fixed32 && !filter.Fixed32) {
+        return -1;
+    }
+
+    filter.Fixed32 = config->fixed32;
+#else
+    if (config->fixed32) {
+        return -1;
+    }
+#endif
+
+    for (unsigned i = 0; i < TOTAL_SAMPLES / samples_per_call; i++) {
+        uint8_t* in = (uint8_t*)pdm + i * bytes_per_call;
+        uint16_t* call_out = (uint16_t*)pcm + i * samples_per_call;
+
+        if (config->decimation == 64) {
+            Open_PDM_Filter_64(in, call_out, filter.MaxVolume, &filter);
+        } else {
+            Open_PDM_Filter_128(in, call_out, filter.MaxVolume, &filter);
+        }
+    }
+
+    memcpy(out, pcm + SETTLE_SAMPLES, MEASURE_SAMPLES * sizeof(out[0]));
+
+    if (rounding_dc != NULL) {
+        *rounding_dc = rounding_dc_lsb(&filter);
+    }
+
+    return 0;
+}
+
+// power of the tone in a bin, in full scale units
+static double bin_power(const int16_t* x, double freq) {
+    double complex sum = 0;
+
+    for (unsigned i = 0; i < MEASURE_SAMPLES; i++) {
+        sum += x[i] * cexp(-I * 2 * M_PI * freq * i / SAMPLE_RATE);
+    }
+
+    return 2 * pow(cabs(sum) / MEASURE_SAMPLES / 32768.0, 2);
+}
+
+static double mean(const int16_t* x) {
+    double sum = 0;
+
+    for (unsigned i = 0; i < MEASURE_SAMPLES; i++) {
+        sum += x[i];
+    }
+
+    return sum / MEASURE_SAMPLES;
+}
+
+// power without DC
+static double ac_power(const int16_t* x) {
+    double dc = mean(x);
+    double sum = 0;
+
+    for (unsigned i = 0; i < MEASURE_SAMPLES; i++) {
+        sum += (x[i] - dc) * (x[i] - dc);
+    }
+
+    return sum / MEASURE_SAMPLES / (32768.0 * 32768.0);
+}
+
+static double db(double power) {
+    return 10 * log10(power);
+}
+
+static int16_t out[MEASURE_SAMPLES];
+
+// every configuration of a decimation decodes the same signals, which are
+// only modulated once
+#define PDM_CACHE_SIZE 64
+
+static struct {
+    unsigned decimation;
+    double freq;
+    double level;
+    int is_sweep;
+    uint8_t* pdm;
+} pdm_cache[PDM_CACHE_SIZE];
+
+static const uint8_t* modulate(unsigned decimation, double freq, double level, int is_sweep) {
+    unsigned i;
+
+    for (i = 0; i < PDM_CACHE_SIZE && pdm_cache[i].pdm != NULL; i++) {
+        if (pdm_cache[i].decimation == decimation && pdm_cache[i].freq == freq && pdm_cache[i].level == level &&
+            pdm_cache[i].is_sweep == is_sweep) {
+            return pdm_cache[i].pdm;
+        }
+    }
+
+    if (i == PDM_CACHE_SIZE) {
+        printf("too many test signals\n");
+        exit(1);
+    }
+
+    struct sdm sdm;
+    uint8_t* pdm = malloc((size_t)TOTAL_SAMPLES * decimation / 8);
+
+    sdm_init(&sdm);
+    generate_pdm(&sdm, pdm, decimation, freq, level, is_sweep);
+
+    if (sdm.resets) {
+        printf("modulator unstable at %.2f of full scale\n", level);
+        exit(1);
+    }
+
+    pdm_cache[i].decimation = decimation;
+    pdm_cache[i].freq = freq;
+    pdm_cache[i].level = level;
+    pdm_cache[i].is_sweep = is_sweep;
+    pdm_cache[i].pdm = pdm;
+
+    return pdm;
+}
+
+static void run_tone(const struct config* config, double freq, double level) {
+    decode(config, modulate(config->decimation, freq, level, 0), out, NULL);
+}
+
+struct quality {
+    double snr_db;
+    double thd_n_db;
+    double full_scale_thd_n_db;
+    double ripple_db;
+    double alias_rejection_db;
+    double dc_lsb;
+    double rounding_dc_lsb;
+    double idle_noise_db;
+};
+
+// SNR and THD+N of a 1 kHz tone, relative to the tone
+static void measure_tone(const struct config* config, double level, double* snr_db, double* thd_n_db) {
+    double freq = 1000;
+
+    run_tone(config, freq, level);
+
+    double total = ac_power(out);
+    double fundamental = bin_power(out, freq);
+    double harmonics = 0;
+
+    for (unsigned h = 2; h <= HARMONICS && h * freq < SAMPLE_RATE / 2; h++) {
+        harmonics += bin_power(out, h * freq);
+    }
+
+    *thd_n_db = db((total - fundamental) / fundamental);
+    *snr_db = db(fundamental / (total - fundamental - harmonics));
+}
+
+static double sweep_freq(unsigned point) {
+    if (point == SWEEP_POINTS - 1) {
+        return PASSBAND_HIGH_HZ;
+    }
+
+    return PASSBAND_LOW_HZ * pow(2, (double)point / SWEEP_OCTAVE_POINTS);
+}
+
+static double complex dft(const double* x, double freq) {
+    double complex sum = 0;
+
+    for (unsigned i = 0; i < MEASURE_SAMPLES; i++) {
+        sum += x[i] * cexp(-I * 2 * M_PI * freq * i / SAMPLE_RATE);
+    }
+
+    return sum;
+}
+
+// Gain of the sweep across the passband, the output spectrum over the input
+// one at every point, and its max - min. The sweep passes every frequency
+// once, away from the faded ends, so the delay of the filter and the edges
+// of the measurement do not matter.
+static double measure_ripple(const struct config* config, double* gains_db) {
+    static double input[MEASURE_SAMPLES];
+    static double output[MEASURE_SAMPLES];
+    double lo = INFINITY;
+    double hi = -INFINITY;
+
+    decode(config, modulate(config->decimation, 0, TONE_LEVEL, 1), out, NULL);
+
+    for (unsigned i = 0; i < MEASURE_SAMPLES; i++) {
+        input[i] = TONE_LEVEL * sweep((double)i / SAMPLE_RATE);
+        output[i] = out[i] / 32768.0;
+    }
+
+    for (unsigned i = 0; i < SWEEP_POINTS; i++) {
+        double freq = sweep_freq(i);
+
+        gains_db[i] = 20 * log10(cabs(dft(output, freq)) / cabs(dft(input, freq)));
+
+        lo = fmin(lo, gains_db[i]);
+        hi = fmax(hi, gains_db[i]);
+    }
+
+    return hi - lo;
+}
+
+// tones that alias onto the passband frequency, against a tone at it
+static const double alias_freqs[] = { 1000, 3000 };
+static const int alias_images[] = { -1, 1, -2, 2 };
+
+static double measure_alias_rejection(const struct config* config) {
+    double worst = INFINITY;
+
+    for (unsigned i = 0; i < COUNT_OF(alias_freqs); i++) {
+        run_tone(config, alias_freqs[i], TONE_LEVEL);
+
+        double passband = bin_power(out, alias_freqs[i]);
+
+        for (unsigned j = 0; j < COUNT_OF(alias_images); j++) {
+            int image = alias_images[j];
+            double freq = abs(image) * SAMPLE_RATE + (image < 0 ? -alias_freqs[i] : alias_freqs[i]);
+
+            run_tone(config, freq, TONE_LEVEL);
+
+            worst = fmin(worst, db(passband / bin_power(out, alias_freqs[i])));
+        }
+    }
+
+    return worst;
+}
+
+static void measure(const struct config* config, struct quality* quality, double* gains_db) {
+    double full_scale_snr_db;
+
+    measure_tone(config, TONE_LEVEL, &quality->snr_db, &quality->thd_n_db);
+    measure_tone(config, FULL_SCALE_LEVEL, &full_scale_snr_db, &quality->full_scale_thd_n_db);
+
+    quality->ripple_db = measure_ripple(config, gains_db);
+    quality->alias_rejection_db = measure_alias_rejection(config);
+
+    // noise floor on silence
+    run_tone(config, 0, 0);
+    quality->idle_noise_db = db(ac_power(out));
+
+    // offset the filter rounding adds to a tone, which averages to zero
+    decode(config, modulate(config->decimation, 1000, TONE_LEVEL, 0), out, &quality->rounding_dc_lsb);
+    quality->dc_lsb = mean(out);
+}
+
+/*
+ * Quality of each decimation and number of half-band stages with sinc order
+ * 3, a few dB short of what the filter measures. Only lower one for a
+ * deliberate trade-off. The DC offset is not a threshold: it has to be
+ * within DC_TOLERANCE_LSB of rounding_dc_lsb().
+ */
+struct thresholds {
+    unsigned decimation;
+    unsigned stages;
+    double min_snr_db;
+    double max_thd_n_db;
+    double max_full_scale_thd_n_db;
+    double max_ripple_db;
+    double min_alias_rejection_db;
+    double max_idle_noise_db;
+};
+
+static const struct thresholds thresholds[] = {
+    { 64,  0, 78, -78, -78, 5.6, 35, -90 },
+    { 128, 0, 86, -86, -89, 5.6, 35, -90 },
+    { 64,  1, 74, -74, -75, 2.5, 56, -90 },
+    { 128, 1, 86, -85, -85, 2.5, 56, -95 },
+    { 64,  2, 78, -78, -79, 2.8, 60, -90 },
+    { 128, 2, 88, -87, -86, 2.8, 60, -94 },
+};
+
+static int check(const char* name, double value, double limit, int is_min) {
+    if (is_min ? (value >= limit) : (value <= limit)) {
+        return 0;
+    }
+
+    printf("FAIL: %s %.2f, %s %.2f\n", name, value, is_min ? "minimum" : "maximum", limit);
+
+    return 1;
+}
+
+static const char* datapath_names[] = { "int64", "fixed32" };
+
+int main() {
+    static const unsigned decimations[] = { 64, 128 };
+    int failures = 0;
+
+    printf("sinc order %d, %d Hz, %d order modulator, tones at %.1f dBFS, full scale %.1f dBFS\n\n",
+        SINCN, SAMPLE_RATE, SDM_ORDER, db(TONE_LEVEL * TONE_LEVEL), db(FULL_SCALE_LEVEL * FULL_SCALE_LEVEL));
+    printf("decimation  halfband  datapath  SNR dB  THD+N dB  FS THD+N dB  ripple dB  alias dB  DC LSB  rounding  idle dBFS\n");
+
+    for (unsigned d = 0; d < COUNT_OF(decimations); d++) {
+        if (decimations[d] > DECIMATION_MAX) {
+            continue;
+        }
+
+        for (unsigned stages = 0; stages <= HALFBAND_STAGES_MAX; stages++) {
+            const struct thresholds* limits = NULL;
+
+            for (unsigned i = 0; i < COUNT_OF(thresholds); i++) {
+                if (thresholds[i].decimation == decimations[d] && thresholds[i].stages == stages) {
+                    limits = &thresholds[i];
+                }
+            }
+
+            for (int fixed32 = 0; fixed32 <= FIXED32_MAX; fixed32++) {
+                struct config config = { decimations[d], stages, fixed32 };
+                struct quality quality;
+                double gains_db[SWEEP_POINTS];
+
+                if (decode(&config, modulate(config.decimation, 0, 0, 0), out, NULL) < 0) {
+                    if (limits != NULL) {
+                        printf("FAIL: decimation %u, %u half-band stages, %s datapath not available\n",
+                            config.decimation, stages, datapath_names[fixed32]);
+                        failures++;
+                    }
+
+                    continue;
+                }
+
+                measure(&config, &quality, gains_db);
+
+                printf("%10u  %8u  %8s  %6.1f  %8.1f  %11.1f  %9.2f  %8.1f  %6.2f  %8.2f  %9.1f\n",
+                    config.decimation, stages, datapath_names[fixed32],
+                    quality.snr_db, quality.thd_n_db, quality.full_scale_thd_n_db,
+                    quality.ripple_db, quality.alias_rejection_db, quality.dc_lsb, quality.rounding_dc_lsb,
+                    quality.idle_noise_db);
+
+                // every octave of the sweep
+                printf("          passband dB:");
+                for (unsigned i = 0; i < SWEEP_POINTS; i++) {
+                    if (i % SWEEP_OCTAVE_POINTS == 0 || i == SWEEP_POINTS - 1) {
+                        printf(" %.0f Hz %.2f", sweep_freq(i), gains_db[i]);
+                    }
+                }
+                printf("\n");
+
+                if (limits == NULL) {
+                    continue;
+                }
+
+                failures += check("SNR dB", quality.snr_db, limits->min_snr_db, 1);
+                failures += check("THD+N dB", quality.thd_n_db, limits->max_thd_n_db, 0);
+                failures += check("full scale THD+N dB", quality.full_scale_thd_n_db, limits->max_full_scale_thd_n_db, 0);
+                failures += check("passband ripple dB", quality.ripple_db, limits->max_ripple_db, 0);
+                failures += check("alias rejection dB", quality.alias_rejection_db, limits->min_alias_rejection_db, 1);
+                failures += check("DC offset from rounding LSB", fabs(quality.dc_lsb - quality.rounding_dc_lsb), DC_TOLERANCE_LSB, 0);
+                failures += check("idle noise dBFS", quality.idle_noise_db, limits->max_idle_noise_db, 0);
+            }
+        }
+    }
+
+    if (failures) {
+        printf("\n%d measurements below the quality thresholds or configurations not decoded\n", failures);
+
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Checks pdm_transpose() against the raw data layout of the capture path:
+ * known bit streams, one per state machine group bit, are shifted into the
+ * ISR as the PDM programs do, pushed in 8 clocks of every group bit (up to
+ * 32 bits) or in 32 bits with PDM_MICROPHONE_PUSH_32, and written by the DMA
+ * with its byte swap for 1 and 2 channels. After the transposition byte
+ * channels * k + g has to hold clocks 8k to 8k + 7 of group bit g, oldest in
+ * the top bit, which is what the filter reads for a channel at offset g.
+ * Exits with 1 on a mismatch, the host build runs it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pdm_microphone_decode.h"
+
+#define CLOCKS      1024
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint8_t streams[8][CLOCKS / 8];
+
+static int stream_bit(unsigned g, unsigned t) {
+    return (streams[g][t / 8] >> (7 - t % 8)) & 1;
+}
+
+// raw buffer of CLOCKS clocks of channels group bits
+static void capture(uint8_t* raw, unsigned channels, int push_32) {
+    unsigned push_bits = push_32 ? 32 : ((8 * channels > 32) ? 32 : 8 * channels);
+    unsigned transfer_size = push_bits / 8;
+    int bswap = channels <= 2;
+    uint32_t isr = 0;
+    unsigned isr_bits = 0;
+    size_t size = 0;
+
+    for (unsigned t = 0; t < CLOCKS; t++) {
+        // group bit g in bit g, shifted in left
+        for (unsigned g = channels; g-- > 0;) {
+            isr = (isr << 1) | stream_bit(g, t);
+        }
+        isr_bits += channels;
+
+        if (isr_bits < push_bits) {
+            continue;
+        }
+
+        // little endian memory, the DMA byte swap reverses the transfer
+        for (unsigned b = 0; b < transfer_size; b++) {
+            unsigned shift = bswap ? (8 * (transfer_size - 1 - b)) : (8 * b);
+
+            raw[size++] = isr >> shift;
+        }
+
+        isr = 0;
+        isr_bits = 0;
+    }
+}
+
+static int check(unsigned channels, int push_32) {
+    static uint8_t raw[8 * CLOCKS / 8] __attribute__((aligned(4)));
+    size_t size = channels * CLOCKS / 8;
+    int mismatches = 0;
+
+    capture(raw, channels, push_32);
+
+    if (channels > 1) {
+        pdm_transpose(raw, size, channels);
+    }
+
+    for (unsigned k = 0; k < CLOCKS / 8; k++) {
+        for (unsigned g = 0; g < channels; g++) {
+            if (raw[channels * k + g] != streams[g][k]) {
+                mismatches++;
+            }
+        }
+    }
+
+    printf("%8u  %9u  %10d\n", channels, push_32 ? 32 : ((8 * channels > 32) ? 32 : 8 * channels), mismatches);
+
+    return mismatches;
+}
+
+int main() {
+    static const unsigned channel_counts[] = { 1, 2, 4, 8 };
+    int failures = 0;
+
+    srand(1);
+
+    for (unsigned g = 0; g < COUNT_OF(streams); g++) {
+        for (unsigned k = 0; k < COUNT_OF(streams[0]); k++) {
+            streams[g][k] = rand();
+        }
+    }
+
+    printf("channels  push bits  mismatches\n");
+
+    for (unsigned c = 0; c < COUNT_OF(channel_counts); c++) {
+        for (int push_32 = 0; push_32 <= 1; push_32++) {
+            failures += check(channel_counts[c], push_32) != 0;
+        }
+    }
+
+    if (failures) {
+        printf("\n%d layouts transposed wrongly\n", failures);
+
+        return 1;
+    }
+
+    return 0;
+}
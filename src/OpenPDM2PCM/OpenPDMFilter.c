@@ -31,95 +31,89 @@
  
 #include "OpenPDMFilter.h"
  
+#ifdef USE_GENERATED_TABLES
+#ifndef GENERATED_TABLES_SECTION
+#ifdef GENERATED_TABLES_IN_RAM
+/* The Look-Up Table is read randomly and is larger than the RP2040 XIP
+ * cache, so keep a copy in SRAM (copied with .data at boot). */
+#define GENERATED_TABLES_SECTION __attribute__((section(".data.pdm_filter_tables")))
+#else
+#define GENERATED_TABLES_SECTION
+#endif
+#endif
+#include "OpenPDMFilter_tables.h"
+#endif
+ 
  
 /* Variables -----------------------------------------------------------------*/
  
-uint32_t div_const = 0;
-int64_t sub_const = 0;
+/* Scratch buffers, only used while building a table. */
 uint32_t sinc[DECIMATION_MAX * SINCN];
 uint32_t sinc1[DECIMATION_MAX];
-uint32_t sinc2[DECIMATION_MAX * 2];
-uint32_t coef[SINCN][DECIMATION_MAX];
+uint32_t sinc2[DECIMATION_MAX * (SINCN - 1)];
+ 
+#ifndef USE_GENERATED_TABLES
+/* Table used by channels that do not provide their own, built for the first
+ * decimation asked for. */
+TPDMFilter_Table default_table;
 #ifdef USE_LUT
-int32_t lut[256][DECIMATION_MAX / 8][SINCN];
+TPDMFilter_LUT_Entry default_lut[DECIMATION_MAX / 8][256][SINCN];
+#endif
+#endif
+ 
+#ifdef USE_HALFBAND
+/* Level the sinc filter output is scaled to before the half-band stages:
+ * with Q14 taps whose absolute values add up to less than 1.6, two stages
+ * and the compensator keep every sum inside int32. */
+#define HALFBAND_FULL_SCALE (1 << 16)
+ 
+/*
+ * Half-band side taps in Q14 for the offsets 1, 3, 5... from the 0.5 centre
+ * tap, every other tap is zero. Least squares designs: A (first of two
+ * stages) passes 0.1125 and stops from 0.3875 of its input rate, B passes
+ * 0.2 and stops from 0.3, both with 56 dB of attenuation.
+ */
+static const int16_t halfband_a[(HALFBAND_A_TAPS + 1) / 4] = {
+  4909, -996, 183
+};
+static const int16_t halfband_b[(HALFBAND_B_TAPS + 1) / 4] = {
+  5169, -1624, 862, -509, 305, -176, 95, -45, 19
+};
 #endif
  
  
 /* Functions -----------------------------------------------------------------*/
  
 #ifdef USE_LUT
-int32_t filter_table_mono_64(uint8_t *data, uint8_t sincn)
-{
-  return (int32_t)
-    lut[data[0]][0][sincn] +
-    lut[data[1]][1][sincn] +
-    lut[data[2]][2][sincn] +
-    lut[data[3]][3][sincn] +
-    lut[data[4]][4][sincn] +
-    lut[data[5]][5][sincn] +
-    lut[data[6]][6][sincn] +
-    lut[data[7]][7][sincn];
-}
-int32_t filter_table_stereo_64(uint8_t *data, uint8_t sincn)
-{
-  return (int32_t)
-    lut[data[0]][0][sincn] +
-    lut[data[2]][1][sincn] +
-    lut[data[4]][2][sincn] +
-    lut[data[6]][3][sincn] +
-    lut[data[8]][4][sincn] +
-    lut[data[10]][5][sincn] +
-    lut[data[12]][6][sincn] +
-    lut[data[14]][7][sincn];
-}
-int32_t filter_table_mono_128(uint8_t *data, uint8_t sincn)
-{
-  return (int32_t)
-    lut[data[0]][0][sincn] +
-    lut[data[1]][1][sincn] +
-    lut[data[2]][2][sincn] +
-    lut[data[3]][3][sincn] +
-    lut[data[4]][4][sincn] +
-    lut[data[5]][5][sincn] +
-    lut[data[6]][6][sincn] +
-    lut[data[7]][7][sincn] +
-    lut[data[8]][8][sincn] +
-    lut[data[9]][9][sincn] +
-    lut[data[10]][10][sincn] +
-    lut[data[11]][11][sincn] +
-    lut[data[12]][12][sincn] +
-    lut[data[13]][13][sincn] +
-    lut[data[14]][14][sincn] +
-    lut[data[15]][15][sincn];
-}
-int32_t filter_table_stereo_128(uint8_t *data, uint8_t sincn)
+/*
+ * Accumulates all SINCN stages of one output sample in a single pass over its
+ * input bytes: the entries of a byte for every stage are adjacent in the LUT.
+ * Always inlined so columns and channels are constants in each caller.
+ */
+static inline __attribute__((always_inline))
+void filter_table_fused(const TPDMFilter_Table *table, uint8_t *data, uint8_t columns, uint8_t channels, int32_t *Z)
 {
-  return (int32_t)
-    lut[data[0]][0][sincn] +
-    lut[data[2]][1][sincn] +
-    lut[data[4]][2][sincn] +
-    lut[data[6]][3][sincn] +
-    lut[data[8]][4][sincn] +
-    lut[data[10]][5][sincn] +
-    lut[data[12]][6][sincn] +
-    lut[data[14]][7][sincn] +
-    lut[data[16]][8][sincn] +
-    lut[data[18]][9][sincn] +
-    lut[data[20]][10][sincn] +
-    lut[data[22]][11][sincn] +
-    lut[data[24]][12][sincn] +
-    lut[data[26]][13][sincn] +
-    lut[data[28]][14][sincn] +
-    lut[data[30]][15][sincn];
+  const TPDMFilter_LUT_Entry (*lut)[256][SINCN] = table->LUT;
+  const TPDMFilter_LUT_Entry *entry;
+  uint8_t d, s;
+ 
+  for (s = 0; s < SINCN; s++) {
+    Z[s] = 0;
+  }
+ 
+  for (d = 0; d < columns; d++) {
+    entry = lut[d][data[d * channels]];
+    for (s = 0; s < SINCN; s++) {
+      Z[s] += entry[s];
+    }
+  }
 }
-int32_t (* filter_tables_64[2]) (uint8_t *data, uint8_t sincn) = {filter_table_mono_64, filter_table_stereo_64};
-int32_t (* filter_tables_128[2]) (uint8_t *data, uint8_t sincn) = {filter_table_mono_128, filter_table_stereo_128};
 #else
 int32_t filter_table(uint8_t *data, uint8_t sincn, TPDMFilter_InitStruct *param)
 {
   uint8_t c, i;
   uint16_t data_index = 0;
-  uint32_t *coef_p = &coef[sincn][0];
+  const uint32_t *coef_p = &param->Table->Coef[sincn][0];
   int32_t F = 0;
   uint8_t decimation = param->Decimation;
   uint8_t channels = param->In_MicChannels;
@@ -161,50 +155,82 @@ void convolve(uint32_t Signal[/* SignalLen */], unsigned short SignalLen,
   }
 }
  
-void Open_PDM_Filter_Init(TPDMFilter_InitStruct *Param)
+int Open_PDM_Filter_Table_Init(TPDMFilter_Table *table, uint8_t decimation, TPDMFilter_LUT_Entry (*lut)[256][SINCN])
 {
-  uint16_t i, j;
+  uint16_t i, j, len;
   int64_t sum = 0;
  
-  uint8_t decimation = Param->Decimation;
+  if (decimation == 0 || decimation % 8 != 0 || decimation > DECIMATION_MAX) {
+    return -1;
+  }
  
-  for (i = 0; i < SINCN; i++) {
-    Param->Coef[i] = 0;
-    Param->bit[i] = 0;
+  /* The filter output (the sum of all coefficients, decimation ^ SINCN) must
+   * fit the int32 LUT sums. */
+  sum = 1;
+  for (j = 0; j < SINCN; j++) {
+    sum *= decimation;
+  }
+  if (sum > 0x7fffffff) {
+    return -1;
   }
+  sum = 0;
+ 
+  table->Decimation = decimation;
+ 
   for (i = 0; i < decimation; i++) {
     sinc1[i] = 1;
+    sinc2[i] = 1;
   }
  
-  Param->OldOut = Param->OldIn = Param->OldZ = 0;
-  Param->LP_ALFA = (Param->LP_HZ != 0 ? (uint16_t) (Param->LP_HZ * 256 / (Param->LP_HZ + Param->Fs / (2 * 3.14159))) : 0);
-  Param->HP_ALFA = (Param->HP_HZ != 0 ? (uint16_t) (Param->Fs * 256 / (2 * 3.14159 * Param->HP_HZ + Param->Fs)) : 0);
- 
-  Param->FilterLen = decimation * SINCN;       
+  /* SINCN boxcars of decimation taps convolved together, with a zero before
+   * and zeros after so there are SINCN * decimation coefficients. */
+  len = decimation;
+  for (j = 1; j < SINCN; j++) {
+    convolve(sinc2, len, sinc1, decimation, &sinc[1]);
+    len += decimation - 1;
+    if (j < SINCN - 1) {
+      for (i = 0; i < len; i++) {
+        sinc2[i] = sinc[i + 1];
+      }
+    }
+  }
   sinc[0] = 0;
-  sinc[decimation * SINCN - 1] = 0;      
-  convolve(sinc1, decimation, sinc1, decimation, sinc2);
-  convolve(sinc2, decimation * 2 - 1, sinc1, decimation, &sinc[1]);     
+  for (i = len + 1; i < decimation * SINCN; i++) {
+    sinc[i] = 0;
+  }
   for(j = 0; j < SINCN; j++) {
     for (i = 0; i < decimation; i++) {
-      coef[j][i] = sinc[j * decimation + i];
+      table->Coef[j][i] = sinc[j * decimation + i];
       sum += sinc[j * decimation + i];
     }
   }
  
-  sub_const = sum >> 1;
-  div_const = sub_const * Param->MaxVolume / 32768 / FILTER_GAIN;
-  div_const = (div_const == 0 ? 1 : div_const);
+  table->SubConst = sum >> 1;
  
 #ifdef USE_LUT
   /* Look-Up Table. */
   uint16_t c, d, s;
+#ifdef USE_LUT_16BIT
+  /* The largest entry of a column is the sum of its eight coefficients. */
+  for (s = 0; s < SINCN; s++) {
+    for (d = 0; d < decimation / 8; d++) {
+      uint32_t max = 0;
+      for (i = 0; i < 8; i++) {
+        max += table->Coef[s][d * 8 + i];
+      }
+      if (max > 0xffff) {
+        return -1;
+      }
+    }
+  }
+#endif
+  table->LUT = (const TPDMFilter_LUT_Entry (*)[256][SINCN]) lut;
   for (s = 0; s < SINCN; s++)
   {
-    uint32_t *coef_p = &coef[s][0];
-    for (c = 0; c < 256; c++)
-      for (d = 0; d < decimation / 8; d++)
-        lut[c][d][s] = ((c >> 7)       ) * coef_p[d * 8    ] +
+    uint32_t *coef_p = &table->Coef[s][0];
+    for (d = 0; d < decimation / 8; d++)
+      for (c = 0; c < 256; c++)
+        lut[d][c][s] = ((c >> 7)       ) * coef_p[d * 8    ] +
                        ((c >> 6) & 0x01) * coef_p[d * 8 + 1] +
                        ((c >> 5) & 0x01) * coef_p[d * 8 + 2] +
                        ((c >> 4) & 0x01) * coef_p[d * 8 + 3] +
@@ -213,46 +239,373 @@ void Open_PDM_Filter_Init(TPDMFilter_InitStruct *Param)
                        ((c >> 1) & 0x01) * coef_p[d * 8 + 6] +
                        ((c     ) & 0x01) * coef_p[d * 8 + 7];
   }
+#else
+  (void) lut;
 #endif
+ 
+  return 0;
 }
  
-void Open_PDM_Filter_64(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param)
+const TPDMFilter_Table *Open_PDM_Filter_Get_Table(uint8_t decimation)
 {
-  uint8_t i, data_out_index;
-  uint8_t channels = Param->In_MicChannels;
-  uint8_t data_inc = ((DECIMATION_MAX >> 4) * channels);
-  int64_t Z, Z0, Z1, Z2;
-  int64_t OldOut, OldIn, OldZ;
+#ifdef USE_GENERATED_TABLES
+  const TPDMFilter_Table *const *table;
  
-  OldOut = Param->OldOut;
-  OldIn = Param->OldIn;
-  OldZ = Param->OldZ;
+  for (table = generated_tables; *table != 0; table++) {
+    if ((*table)->Decimation == decimation) {
+      return *table;
+    }
+  }
  
+  return 0;
+#else
+  /* Channels decode from the default table once it is handed out, so it is
+   * never rebuilt: another decimation needs a table of its own. */
+  if (default_table.Decimation == decimation) {
+    return &default_table;
+  }
+  if (default_table.Decimation != 0) {
+    return 0;
+  }
 #ifdef USE_LUT
-  uint8_t j = channels - 1;
+  if (Open_PDM_Filter_Table_Init(&default_table, decimation, default_lut) < 0) {
+#else
+  if (Open_PDM_Filter_Table_Init(&default_table, decimation, 0) < 0) {
+#endif
+    default_table.Decimation = 0;
+    return 0;
+  }
+  return &default_table;
+#endif
+}
+ 
+/*
+ * Output samples saturate once |OldZ| * volume / DivConst reaches 32700, so
+ * OldZ is clamped to Limit (that level, or the largest |OldZ| the decimation
+ * can produce if lower) first and the per-sample division becomes a
+ * multiplication by a reciprocal of volume / DivConst and a shift. This only
+ * runs when the volume changes.
+ *
+ * int64 datapath: ScaleMul is the 32-bit reciprocal with the largest shift,
+ * its relative error is below 2^-31, so the result matches RoundDiv except
+ * when the exact quotient is within Limit / 2^(ScaleShift + 1) of a rounding
+ * tie, and then differs by 1.
+ *
+ * 32-bit datapath: the largest shift that keeps Limit * ScaleMul32 (plus
+ * rounding) inside int32, which holds for every volume, MaxVolume and Gain.
+ */
+static void filter_scale_update(TPDMFilter_InitStruct *Param, uint16_t volume)
+{
+  uint32_t div = Param->DivConst;
+  uint64_t mul = 0;
+  uint64_t bound;
+  uint32_t limit;
+  uint8_t shift;
+ 
+  Param->Volume = volume;
+ 
+  if (volume == 0) {
+    Param->Limit = 0;
+    Param->ScaleMul = 0;
+    Param->ScaleShift = 0;
+#ifdef USE_FIXED32
+    Param->ScaleMul32 = 0;
+    Param->ScaleShift32 = 0;
+#endif
+    return;
+  }
+ 
+  /* |OldZ| stays within 2 * PeakZ plus what the high and low pass
+   * rounding can add, so a smaller bound keeps more precision. */
+  bound = ((uint64_t) 32700 * div + volume - 1) / volume + 1;
+  if (bound > 2 * (uint64_t) Param->PeakZ + 512) {
+    bound = 2 * (uint64_t) Param->PeakZ + 512;
+  }
+  limit = (bound > 0x7fffffff) ? 0x7fffffff : (uint32_t) bound;
+  Param->Limit = limit;
+ 
+  for (shift = 0; shift < 47; shift++) {
+    if (((((uint64_t) volume << (shift + 1)) + div / 2) / div) > 0xffffffffu) {
+      break;
+    }
+  }
+  Param->ScaleMul = (((uint64_t) volume << shift) + div / 2) / div;
+  Param->ScaleShift = shift;
+ 
+#ifdef USE_FIXED32
+  for (shift = 30; shift > 0; shift--) {
+    mul = (((uint64_t) volume << shift) + div / 2) / div;
+    if ((uint64_t) limit * mul + (1u << (shift - 1)) < 0x80000000u) {
+      break;
+    }
+  }
+  if (shift == 0) {
+    mul = (volume + div / 2) / div;
+  }
+ 
+  Param->ScaleMul32 = mul;
+  Param->ScaleShift32 = shift;
+#else
+  (void) mul;
+#endif
+}
+ 
+int Open_PDM_Filter_Init(TPDMFilter_InitStruct *Param)
+{
+  uint16_t i;
+  uint32_t fullscale;
+  uint8_t stages = 0;
+ 
+#ifdef USE_HALFBAND
+  stages = Param->HalfBandStages;
+  if (stages > 2) {
+    return -1;
+  }
+#endif
+ 
+  /* Decimation of the sinc filter, the half-band stages do the rest */
+  uint8_t decimation = Param->Decimation >> stages;
+ 
+  if ((decimation << stages) != Param->Decimation) {
+    return -1;
+  }
+  if (Param->Table == 0) {
+    Param->Table = Open_PDM_Filter_Get_Table(decimation);
+  }
+  if (Param->Table == 0 || Param->Table->Decimation != decimation) {
+    return -1;
+  }
+  if (Param->FrameSamples == 0) {
+    Param->FrameSamples = Param->Fs / 1000;
+  }
+  if (Param->FrameSamples == 0) {
+    return -1;
+  }
+ 
+  for (i = 0; i < SINCN; i++) {
+    Param->Coef[i] = 0;
+    Param->bit[i] = 0;
+  }
+ 
+  Param->OldOut = Param->OldIn = Param->OldZ = 0;
+#ifdef USE_STATS
+  Param->Saturations = 0;
+#endif
+  Param->LP_ALFA = (Param->LP_HZ != 0 ? (uint16_t) (Param->LP_HZ * 256 / (Param->LP_HZ + Param->Fs / (2 * 3.14159))) : 0);
+  Param->HP_ALFA = (Param->HP_HZ != 0 ? (uint16_t) (Param->Fs * 256 / (2 * 3.14159 * Param->HP_HZ + Param->Fs)) : 0);
+ 
+  Param->FilterLen = decimation * SINCN;       
+ 
+  /* Full scale and largest |Z| seen by the high pass */
+  fullscale = Param->Table->SubConst;
+  Param->PeakZ = fullscale;
+ 
+#ifdef USE_HALFBAND
+  if (stages) {
+    Param->HBShiftUp = Param->HBShiftDown = 0;
+    while ((fullscale << 1) <= HALFBAND_FULL_SCALE) {
+      fullscale <<= 1;
+      Param->HBShiftUp++;
+    }
+    while (fullscale > HALFBAND_FULL_SCALE) {
+      fullscale >>= 1;
+      Param->HBShiftDown++;
+    }
+    /* Gain of the stages is at most 1.25 * 1.58 * 1.45 */
+    Param->PeakZ = 3 * fullscale;
+ 
+    for (i = 0; i < 2 * HALFBAND_A_TAPS; i++) {
+      Param->HBLineA[i] = 0;
+    }
+    for (i = 0; i < 2 * HALFBAND_B_TAPS; i++) {
+      Param->HBLineB[i] = 0;
+    }
+    Param->HBIndexA = Param->HBIndexB = 0;
+    Param->HBCompIn[0] = Param->HBCompIn[1] = 0;
+ 
+    /* The sinc filter response at 0.4 Fs is (sin(x) / x) ^ SINCN with
+     * x = pi * 0.4 / 2 ^ stages, the compensator 1 + 2 * HBComp * (1 - cos(w))
+     * is its inverse there (1 - cos(0.8 pi) = 1.809). */
+    float x = 3.14159f * 0.4f / (1 << stages);
+    float sinc = 1 - x * x / 6 + x * x * x * x / 120;
+    float droop = 1;
+    for (i = 0; i < SINCN; i++) {
+      droop *= sinc;
+    }
+    Param->HBComp = (int16_t) ((1 / droop - 1) / (2 * 1.809017f) * 16384 + 0.5f);
+  }
+#endif
+ 
+  Param->DivConst = (int64_t) fullscale * Param->MaxVolume / 32768 / FILTER_GAIN;
+  Param->DivConst = (Param->DivConst == 0 ? 1 : Param->DivConst);
+ 
+#ifdef USE_FIXED32
+  /* |Z| <= PeakZ, the high pass keeps |OldOut| and |OldZ| within
+   * 2 * PeakZ (plus rounding) and multiplies a sum of four such terms by
+   * HP_ALFA <= 256, so 32 bits are enough while 1024 * (PeakZ + 256) is. */
+  Param->Fixed32 = (Param->PeakZ + 256) < (1 << 21);
 #endif
+  filter_scale_update(Param, Param->MaxVolume);
+ 
+  return 0;
+}
+ 
+/*
+ * One sinc filter output: the sums of the SINCN stages over the input bytes
+ * of a sample go through the comb kept in Coef. Decimation ^ SINCN fits in
+ * 31 bits, so does the result.
+ */
+static inline __attribute__((always_inline))
+int32_t filter_cic(uint8_t *data, TPDMFilter_InitStruct *Param, const TPDMFilter_Table *table, uint8_t decimation, uint8_t channels)
+{
+  int32_t Zs[SINCN];
+  int32_t Z;
+  uint8_t s;
  
-  for (i = 0, data_out_index = 0; i < Param->Fs / 1000; i++, data_out_index += channels) {
 #ifdef USE_LUT
-    Z0 = filter_tables_64[j](data, 0);
-    Z1 = filter_tables_64[j](data, 1);
-    Z2 = filter_tables_64[j](data, 2);
+  filter_table_fused(table, data, decimation >> 3, channels, Zs);
+#else
+  for (s = 0; s < SINCN; s++) {
+    Zs[s] = filter_table(data, s, Param);
+  }
+#endif
+ 
+  Z = (int32_t) (Param->Coef[SINCN - 2] + Zs[SINCN - 1]) - (int32_t) table->SubConst;
+  for (s = SINCN - 2; s > 0; s--) {
+    Param->Coef[s] = Param->Coef[s - 1] + Zs[s];
+  }
+  Param->Coef[0] = Zs[0];
+ 
+  return Z;
+}
+ 
+#ifdef USE_HALFBAND
+/*
+ * Pushes two samples into a half-band delay line and returns the decimated
+ * output. The line is stored twice so the last taps samples are always
+ * contiguous, and only the centre tap and the non-zero pairs around it are
+ * multiplied.
+ */
+static inline __attribute__((always_inline))
+int32_t halfband_decimate(int32_t *line, uint8_t *index, int32_t x0, int32_t x1, const int16_t *coef, uint8_t taps)
+{
+  uint8_t i = *index;
+  uint8_t k, center = taps >> 1;
+  const int32_t *w;
+  int32_t acc;
+ 
+  line[i] = line[i + taps] = x0;
+  i = (i + 1 == taps) ? 0 : i + 1;
+  line[i] = line[i + taps] = x1;
+  i = (i + 1 == taps) ? 0 : i + 1;
+  *index = i;
+ 
+  /* w[0] is the oldest sample, w[taps - 1] is x1 */
+  w = &line[i];
+  acc = w[center] * (1 << 13) + (1 << 13);
+  for (k = 0; k < (taps + 1) / 4; k++) {
+    acc += coef[k] * (w[center - (2 * k + 1)] + w[center + (2 * k + 1)]);
+  }
+ 
+  return acc >> 14;
+}
+ 
+/*
+ * One output of the multi-stage decimator: 2 ^ stages sinc filter outputs at
+ * Decimation >> stages, scaled to HALFBAND_FULL_SCALE, through the half-band
+ * stages and the droop compensator.
+ */
+static inline __attribute__((always_inline))
+int32_t filter_halfband(uint8_t *data, TPDMFilter_InitStruct *Param, const TPDMFilter_Table *table, uint8_t decimation, uint8_t channels, uint8_t stages)
+{
+  uint8_t i;
+  uint8_t data_inc = (decimation >> 3) * channels;
+  int32_t x[4];
+  int32_t Z;
+ 
+  for (i = 0; i < (1 << stages); i++) {
+    Z = filter_cic(data, Param, table, decimation, channels);
+    /* multiplied up, left shifting a negative Z is undefined */
+    x[i] = (Z * (1 << Param->HBShiftUp)) >> Param->HBShiftDown;
+    data += data_inc;
+  }
+ 
+  if (stages == 2) {
+    x[0] = halfband_decimate(Param->HBLineA, &Param->HBIndexA, x[0], x[1], halfband_a, HALFBAND_A_TAPS);
+    x[1] = halfband_decimate(Param->HBLineA, &Param->HBIndexA, x[2], x[3], halfband_a, HALFBAND_A_TAPS);
+  }
+  Z = halfband_decimate(Param->HBLineB, &Param->HBIndexB, x[0], x[1], halfband_b, HALFBAND_B_TAPS);
+ 
+  /* y[n] = x[n - 1] + HBComp * (2 * x[n - 1] - x[n] - x[n - 2]) */
+  x[0] = Param->HBCompIn[0];
+  x[1] = x[0] + ((Param->HBComp * (2 * x[0] - Z - Param->HBCompIn[1]) + (1 << 13)) >> 14);
+  Param->HBCompIn[1] = x[0];
+  Param->HBCompIn[0] = Z;
+ 
+  return x[1];
+}
+#endif
+ 
+/*
+ * Next input of the high pass filter: one sinc filter output, or with
+ * half-band stages the output of the multi-stage decimator. decimation is
+ * the overall one.
+ */
+static inline __attribute__((always_inline))
+int32_t filter_decimate(uint8_t *data, TPDMFilter_InitStruct *Param, const TPDMFilter_Table *table, uint8_t decimation, uint8_t channels, uint8_t stages)
+{
+#ifdef USE_HALFBAND
+  if (stages) {
+    return filter_halfband(data, Param, table, decimation >> stages, channels, stages);
+  }
 #else
-    Z0 = filter_table(data, 0, Param);
-    Z1 = filter_table(data, 1, Param);
-    Z2 = filter_table(data, 2, Param);
+  (void) stages;
+#endif
+  return filter_cic(data, Param, table, decimation, channels);
+}
+ 
+#ifdef USE_FIXED32
+/*
+ * Same filter as filter_run() in 32-bit arithmetic only, for channels whose
+ * headroom Open_PDM_Filter_Init() has proven.
+ */
+static inline __attribute__((always_inline))
+void filter_run_fixed32(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param, uint16_t samples, uint8_t decimation, uint8_t channels, uint8_t stages)
+{
+  uint16_t i, data_out_index;
+  uint8_t data_inc = ((decimation >> 3) * channels);
+  int32_t Z, Limit, ScaleMul, Round;
+  int32_t OldOut, OldIn, OldZ;
+  uint8_t ScaleShift;
+  const TPDMFilter_Table *table = Param->Table;
+ 
+  if (volume != Param->Volume) {
+    filter_scale_update(Param, volume);
+  }
+  Limit = Param->Limit;
+  ScaleMul = Param->ScaleMul32;
+  ScaleShift = Param->ScaleShift32;
+  Round = (1 << ScaleShift) >> 1;
+ 
+  OldOut = Param->OldOut;
+  OldIn = Param->OldIn;
+  OldZ = Param->OldZ;
+#ifdef USE_STATS
+  uint32_t Saturations = Param->Saturations;
 #endif
  
-    Z = Param->Coef[1] + Z2 - sub_const;
-    Param->Coef[1] = Param->Coef[0] + Z1;
-    Param->Coef[0] = Z0;
+  for (i = 0, data_out_index = 0; i < samples; i++, data_out_index += channels) {
+    Z = filter_decimate(data, Param, table, decimation, channels, stages);
  
     OldOut = (Param->HP_ALFA * (OldOut + Z - OldIn)) >> 8;
     OldIn = Z;
     OldZ = ((256 - Param->LP_ALFA) * OldZ + Param->LP_ALFA * OldOut) >> 8;
  
-    Z = OldZ * volume;
-    Z = RoundDiv(Z, div_const);
+    Z = SaturaLH(OldZ, -Limit, Limit);
+#ifdef USE_STATS
+    Saturations += (Z != OldZ);
+#endif
+    Z = RoundMulShift(Z, ScaleMul, ScaleShift, Round);
     Z = SaturaLH(Z, -32700, 32700);
  
     dataOut[data_out_index] = Z;
@@ -262,45 +615,62 @@ void Open_PDM_Filter_64(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMF
   Param->OldOut = OldOut;
   Param->OldIn = OldIn;
   Param->OldZ = OldZ;
+#ifdef USE_STATS
+  Param->Saturations = Saturations;
+#endif
 }
+#endif
  
-void Open_PDM_Filter_128(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param)
+/*
+ * Filters samples output samples. Always inlined into the entry points
+ * below, so the fused kernel is specialized for each decimation, channel
+ * count and number of half-band stages at compile time instead of being
+ * called through a function pointer.
+ */
+static inline __attribute__((always_inline))
+void filter_run(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param, uint16_t samples, uint8_t decimation, uint8_t channels, uint8_t stages)
 {
-  uint8_t i, data_out_index;
-  uint8_t channels = Param->In_MicChannels;
-  uint8_t data_inc = ((DECIMATION_MAX >> 3) * channels);
-  int64_t Z, Z0, Z1, Z2;
+  uint16_t i, data_out_index;
+  uint8_t data_inc = ((decimation >> 3) * channels);
+  int64_t Z, Limit, ScaleMul, Round;
   int64_t OldOut, OldIn, OldZ;
+  uint8_t ScaleShift;
+  const TPDMFilter_Table *table = Param->Table;
+ 
+#ifdef USE_FIXED32
+  if (Param->Fixed32) {
+    filter_run_fixed32(data, dataOut, volume, Param, samples, decimation, channels, stages);
+    return;
+  }
+#endif
+ 
+  if (volume != Param->Volume) {
+    filter_scale_update(Param, volume);
+  }
+  Limit = Param->Limit;
+  ScaleMul = Param->ScaleMul;
+  ScaleShift = Param->ScaleShift;
+  Round = ((int64_t) 1 << ScaleShift) >> 1;
  
   OldOut = Param->OldOut;
   OldIn = Param->OldIn;
   OldZ = Param->OldZ;
- 
-#ifdef USE_LUT
-  uint8_t j = channels - 1;
+#ifdef USE_STATS
+  uint32_t Saturations = Param->Saturations;
 #endif
  
-  for (i = 0, data_out_index = 0; i < Param->Fs / 1000; i++, data_out_index += channels) {
-#ifdef USE_LUT
-    Z0 = filter_tables_128[j](data, 0);
-    Z1 = filter_tables_128[j](data, 1);
-    Z2 = filter_tables_128[j](data, 2);
-#else
-    Z0 = filter_table(data, 0, Param);
-    Z1 = filter_table(data, 1, Param);
-    Z2 = filter_table(data, 2, Param);
-#endif
- 
-    Z = Param->Coef[1] + Z2 - sub_const;
-    Param->Coef[1] = Param->Coef[0] + Z1;
-    Param->Coef[0] = Z0;
+  for (i = 0, data_out_index = 0; i < samples; i++, data_out_index += channels) {
+    Z = filter_decimate(data, Param, table, decimation, channels, stages);
  
     OldOut = (Param->HP_ALFA * (OldOut + Z - OldIn)) >> 8;
     OldIn = Z;
     OldZ = ((256 - Param->LP_ALFA) * OldZ + Param->LP_ALFA * OldOut) >> 8;
  
-    Z = OldZ * volume;
-    Z = RoundDiv(Z, div_const);
+    Z = SaturaLH(OldZ, -Limit, Limit);
+#ifdef USE_STATS
+    Saturations += (Z != OldZ);
+#endif
+    Z = RoundMulShift(Z, ScaleMul, ScaleShift, Round);
     Z = SaturaLH(Z, -32700, 32700);
  
     dataOut[data_out_index] = Z;
@@ -310,5 +680,145 @@ void Open_PDM_Filter_128(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDM
   Param->OldOut = OldOut;
   Param->OldIn = OldIn;
   Param->OldZ = OldZ;
+#ifdef USE_STATS
+  Param->Saturations = Saturations;
+#endif
+}
+ 
+#ifdef USE_HALFBAND
+/*
+ * Multi-stage decimator: mono decimation 64 with two stages (so a sinc filter
+ * decimating by 16) is specialized, anything else runs with the parameters
+ * known at run time only.
+ */
+static void filter_halfband_run(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param, uint16_t samples)
+{
+  if (Param->Decimation == 64 && Param->HalfBandStages == 2 && Param->In_MicChannels == 1) {
+    filter_run(data, dataOut, volume, Param, samples, 64, 1, 2);
+  } else {
+    filter_run(data, dataOut, volume, Param, samples, Param->Decimation, Param->In_MicChannels, Param->HalfBandStages);
+  }
+}
+#endif
+ 
+static void filter_run_64(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param, uint16_t samples)
+{
+#ifdef USE_HALFBAND
+  if (Param->HalfBandStages) {
+    filter_halfband_run(data, dataOut, volume, Param, samples);
+    return;
+  }
+#endif
+  if (Param->In_MicChannels == 1) {
+    filter_run(data, dataOut, volume, Param, samples, 64, 1, 0);
+  } else if (Param->In_MicChannels == 2) {
+    filter_run(data, dataOut, volume, Param, samples, 64, 2, 0);
+  } else {
+    filter_run(data, dataOut, volume, Param, samples, 64, Param->In_MicChannels, 0);
+  }
+}
+ 
+static void filter_run_128(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param, uint16_t samples)
+{
+#ifdef USE_HALFBAND
+  if (Param->HalfBandStages) {
+    filter_halfband_run(data, dataOut, volume, Param, samples);
+    return;
+  }
+#endif
+  if (Param->In_MicChannels == 1) {
+    filter_run(data, dataOut, volume, Param, samples, 128, 1, 0);
+  } else if (Param->In_MicChannels == 2) {
+    filter_run(data, dataOut, volume, Param, samples, 128, 2, 0);
+  } else {
+    filter_run(data, dataOut, volume, Param, samples, 128, Param->In_MicChannels, 0);
+  }
+}
+ 
+/*
+ * The high sample rate decimations, specialized for every channel count a
+ * state machine pushes.
+ */
+static void filter_run_16(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param, uint16_t samples, uint8_t channels)
+{
+  if (channels == 1) {
+    filter_run(data, dataOut, volume, Param, samples, 16, 1, 0);
+  } else if (channels == 2) {
+    filter_run(data, dataOut, volume, Param, samples, 16, 2, 0);
+  } else if (channels == 4) {
+    filter_run(data, dataOut, volume, Param, samples, 16, 4, 0);
+  } else if (channels == 8) {
+    filter_run(data, dataOut, volume, Param, samples, 16, 8, 0);
+  } else {
+    filter_run(data, dataOut, volume, Param, samples, 16, channels, 0);
+  }
+}
+ 
+static void filter_run_32(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param, uint16_t samples, uint8_t channels)
+{
+  if (channels == 1) {
+    filter_run(data, dataOut, volume, Param, samples, 32, 1, 0);
+  } else if (channels == 2) {
+    filter_run(data, dataOut, volume, Param, samples, 32, 2, 0);
+  } else if (channels == 4) {
+    filter_run(data, dataOut, volume, Param, samples, 32, 4, 0);
+  } else if (channels == 8) {
+    filter_run(data, dataOut, volume, Param, samples, 32, 8, 0);
+  } else {
+    filter_run(data, dataOut, volume, Param, samples, 32, channels, 0);
+  }
+}
+ 
+/*
+ * Any decimation that is a multiple of 8: 64 and 128 use the entry points
+ * above, 16 and 32 the ones for high sample rates, mono 48 gets its own
+ * specialization and anything else runs with the decimation and channel
+ * count known at run time only.
+ * Channels with half-band stages go through the multi-stage decimator.
+ * The filter state carries over from one call to the next whatever the
+ * number of samples, so a stream can be decoded in pieces of any length.
+ */
+void Open_PDM_Filter_Samples(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param, uint16_t samples)
+{
+  uint8_t decimation = Param->Decimation;
+  uint8_t channels = Param->In_MicChannels;
+ 
+#ifdef USE_HALFBAND
+  if (Param->HalfBandStages) {
+    filter_halfband_run(data, dataOut, volume, Param, samples);
+    return;
+  }
+#endif
+  if (decimation == 64) {
+    filter_run_64(data, dataOut, volume, Param, samples);
+  } else if (decimation == 128) {
+    filter_run_128(data, dataOut, volume, Param, samples);
+  } else if (decimation == 16) {
+    filter_run_16(data, dataOut, volume, Param, samples, channels);
+  } else if (decimation == 32) {
+    filter_run_32(data, dataOut, volume, Param, samples, channels);
+  } else if (decimation == 48 && channels == 1) {
+    filter_run(data, dataOut, volume, Param, samples, 48, 1, 0);
+  } else {
+    filter_run(data, dataOut, volume, Param, samples, decimation, channels, 0);
+  }
+}
+ 
+/*
+ * FrameSamples output samples.
+ */
+void Open_PDM_Filter_64(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param)
+{
+  filter_run_64(data, dataOut, volume, Param, Param->FrameSamples);
+}
+ 
+void Open_PDM_Filter_128(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param)
+{
+  filter_run_128(data, dataOut, volume, Param, Param->FrameSamples);
+}
+ 
+void Open_PDM_Filter(uint8_t* data, uint16_t* dataOut, uint16_t volume, TPDMFilter_InitStruct *Param)
+{
+  Open_PDM_Filter_Samples(data, dataOut, volume, Param, Param->FrameSamples);
 }
  
@@ -51,8 +51,66 @@
  */
 #define USE_LUT
  
+/*
+ * Define USE_LUT_16BIT (e.g. from the build system) to store the Look-Up
+ * Table as 16-bit entries, halving its size. Every entry is the sum of eight
+ * sinc coefficients, which only fits in 16 bits up to decimation 96 with
+ * SINCN 3 and decimation 16 with SINCN 4; other tables fail to build.
+ */
+ 
+/*
+ * Order of the sinc (CIC) filter, 3 to 5. Decimation ^ SINCN must fit in 31
+ * bits, e.g. decimation 128 is limited to SINCN 4.
+ */
+#ifndef SINCN
 #define SINCN            3
+#endif
+ 
+#if SINCN < 3 || SINCN > 5
+#error "SINCN must be 3, 4 or 5"
+#endif
+ 
+/*
+ * Largest decimation the library default table is sized for. Define it to
+ * the decimation actually in use to avoid reserving unused table memory.
+ */
+#ifndef DECIMATION_MAX
 #define DECIMATION_MAX 128
+#endif
+ 
+/*
+ * Define USE_GENERATED_TABLES when the build generates OpenPDMFilter_tables.h
+ * (see tools/generate_pdm_filter_tables.py). The default tables for those
+ * decimations are then const data in flash (or SRAM with
+ * GENERATED_TABLES_IN_RAM, or the section given by GENERATED_TABLES_SECTION)
+ * and are not built at run time.
+ */
+ 
+/*
+ * Define USE_FIXED32 to build the 32-bit datapath. Open_PDM_Filter_Init()
+ * enables it for a channel when it can prove the decimation leaves enough
+ * headroom for 32-bit arithmetic, the int64 datapath is used otherwise.
+ */
+ 
+/*
+ * Define USE_HALFBAND to build the multi-stage decimator: with HalfBandStages
+ * set to 1 or 2 the sinc filter only decimates by Decimation / 2 or / 4 and
+ * is followed by that many half-band FIR stages decimating by 2 and a CIC
+ * droop compensator, for a flatter passband and better alias rejection than
+ * the sinc filter alone: with the default low pass, about -2.4 dB at Fs / 4
+ * instead of -5.4 dB, and aliases 20 dB lower (see host/pdm_quality.c). The
+ * table then has to be built for the sinc decimation.
+ */
+ 
+/*
+ * Define USE_STATS to count in Saturations the output samples clipped to
+ * full scale, which Open_PDM_Filter_Init() resets.
+ */
+#ifdef USE_HALFBAND
+#define HALFBAND_A_TAPS  11
+#define HALFBAND_B_TAPS  35
+#endif
+ 
 #ifdef PICO_BUILD
 #define FILTER_GAIN     Param->Gain
 #else
@@ -63,15 +121,44 @@
                  (((uint16_t)(A) & 0x00ff) << 8))
 #define RoundDiv(a, b)    (((a)>0)?(((a)+(b)/2)/(b)):(((a)-(b)/2)/(b)))
 #define SaturaLH(N, L, H) (((N)<(L))?(L):(((N)>(H))?(H):(N)))
+/* a * m / 2^s rounded half away from zero like RoundDiv, r = 2^s / 2 */
+#define RoundMulShift(a, m, s, r) (((a)>=0)?(((a)*(m)+(r))>>(s)):(-((-(a)*(m)+(r))>>(s))))
  
  
 /* Types ---------------------------------------------------------------------*/
  
+#ifdef USE_LUT_16BIT
+typedef uint16_t TPDMFilter_LUT_Entry;
+#else
+typedef int32_t TPDMFilter_LUT_Entry;
+#endif
+ 
+/*
+ * Sinc filter coefficients and Look-Up Table for one decimation factor.
+ * Once built by Open_PDM_Filter_Table_Init() it is only read by the filter,
+ * so any number of channels using the same decimation can share one table.
+ *
+ * The LUT is laid out as [Decimation / 8][256][SINCN]: one block per input
+ * byte of a sample, so a table only needs storage for the decimation it was
+ * built for, e.g. TPDMFilter_LUT_Entry lut[64 / 8][256][SINCN].
+ */
+typedef struct {
+  /* Private */
+  uint8_t Decimation;
+  int64_t SubConst;
+  uint32_t Coef[SINCN][DECIMATION_MAX];
+#ifdef USE_LUT
+  const TPDMFilter_LUT_Entry (*LUT)[256][SINCN];
+#endif
+} TPDMFilter_Table;
+ 
 typedef struct {
   /* Public */
   float LP_HZ;
   float HP_HZ;
-  uint16_t Fs;
+  uint32_t Fs;
+  /* Output samples per Open_PDM_Filter() call, 0 for Fs / 1000 */
+  uint16_t FrameSamples;
   uint8_t In_MicChannels;
   uint8_t Out_MicChannels;
   uint8_t Decimation;
@@ -79,7 +166,17 @@ typedef struct {
 #ifdef PICO_BUILD
   uint8_t Gain;
 #endif
+#ifdef USE_HALFBAND
+  /* Half-band stages after the sinc filter, 0 to 2 */
+  uint8_t HalfBandStages;
+#endif
+  /* Shared table, or NULL to use the library default table. Without
+   * USE_GENERATED_TABLES that is built for the first decimation initialized
+   * and init fails for any other, which needs its own table from
+   * Open_PDM_Filter_Table_Init(). */
+  const TPDMFilter_Table *Table;
   /* Private */
+  uint32_t DivConst;
   uint32_t Coef[SINCN];
   uint16_t FilterLen;
   int64_t OldOut, OldIn, OldZ;
@@ -87,14 +184,42 @@ typedef struct {
   uint16_t HP_ALFA;
   uint16_t bit[5];
   uint16_t byte;
+  uint16_t Volume;
+  uint32_t PeakZ;
+  int32_t Limit;
+  uint32_t ScaleMul;
+  uint8_t ScaleShift;
+#ifdef USE_FIXED32
+  uint8_t Fixed32;
+  int32_t ScaleMul32;
+  uint8_t ScaleShift32;
+#endif
+#ifdef USE_STATS
+  uint32_t Saturations;
+#endif
+#ifdef USE_HALFBAND
+  uint8_t HBShiftUp;
+  uint8_t HBShiftDown;
+  int16_t HBComp;
+  int32_t HBLineA[2 * HALFBAND_A_TAPS];
+  int32_t HBLineB[2 * HALFBAND_B_TAPS];
+  uint8_t HBIndexA;
+  uint8_t HBIndexB;
+  int32_t HBCompIn[2];
+#endif
 } TPDMFilter_InitStruct;
  
  
 /* Exported functions ------------------------------------------------------- */
  
-void Open_PDM_Filter_Init(TPDMFilter_InitStruct *init_struct);
+int Open_PDM_Filter_Table_Init(TPDMFilter_Table *table, uint8_t decimation, TPDMFilter_LUT_Entry (*lut)[256][SINCN]);
+const TPDMFilter_Table *Open_PDM_Filter_Get_Table(uint8_t decimation);
+int Open_PDM_Filter_Init(TPDMFilter_InitStruct *init_struct);
 void Open_PDM_Filter_64(uint8_t* data, uint16_t* data_out, uint16_t mic_gain, TPDMFilter_InitStruct *init_struct);
 void Open_PDM_Filter_128(uint8_t* data, uint16_t* data_out, uint16_t mic_gain, TPDMFilter_InitStruct *init_struct);
+void Open_PDM_Filter(uint8_t* data, uint16_t* data_out, uint16_t mic_gain, TPDMFilter_InitStruct *init_struct);
+/* Same as Open_PDM_Filter() for samples output samples instead of FrameSamples */
+void Open_PDM_Filter_Samples(uint8_t* data, uint16_t* data_out, uint16_t mic_gain, TPDMFilter_InitStruct *init_struct, uint16_t samples);
  
 #ifdef __cplusplus
 }
@@ -8,33 +8,69 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "hardware/adc.h"
-#include "hardware/clocks.h"
-#include "hardware/dma.h"
-#include "hardware/irq.h"
-
 #include "pico/analog_microphone.h"
 
-#define ANALOG_RAW_BUFFER_COUNT 2
+#define ANALOG_RAW_BUFFER_COUNT_MAX 8
+
+// capture with a second DMA channel reloading the write address of the first
+// one, so it never stops and waits for the IRQ
+#ifndef ANALOG_MICROPHONE_CHAINED_DMA
+#define ANALOG_MICROPHONE_CHAINED_DMA 1
+#endif
 
 static struct {
     struct analog_microphone_config config;
     int dma_channel;
-    uint16_t* raw_buffer[ANALOG_RAW_BUFFER_COUNT];
-    volatile int raw_buffer_write_index;
-    volatile int raw_buffer_read_index;
+    int dma_control_channel;
+    uint16_t* raw_buffer[ANALOG_RAW_BUFFER_COUNT_MAX];
+    // raw buffers and blocks allocated by analog_microphone_init(), not the
+    // caller
+    bool raw_buffers_allocated;
+    bool blocks_allocated;
+    // the raw buffers, read by the control channel in ring mode, so aligned
+    // to its size
+    void* dma_write_addr[ANALOG_RAW_BUFFER_COUNT_MAX] __attribute__((aligned(ANALOG_RAW_BUFFER_COUNT_MAX * sizeof(void*))));
+    uint raw_buffer_count;
+    // buffers filled by the DMA and read, free running
+    volatile uint32_t raw_buffer_produced;
+    volatile uint32_t raw_buffer_consumed;
+    // samples already read from buffer consumed
+    uint raw_buffer_offset;
+    volatile uint32_t raw_buffer_overruns;
+    uint32_t raw_buffers_dropped;
     uint buffer_size;
+    // the block pool, blocks acquired and released, free running
+    int16_t* blocks;
+    uint32_t blocks_acquired;
+    uint32_t blocks_released;
     int16_t bias;
     uint dma_irq;
     analog_samples_ready_handler_t samples_ready_handler;
+#if ANALOG_MICROPHONE_STATS
+    // latencies in samples
+    uint32_t stats_isr_latency_max;
+    uint64_t stats_isr_latency_sum;
+    uint32_t stats_isr_count;
+    uint32_t stats_buffers_decoded;
+    uint32_t stats_block_cycles_max;
+    uint64_t stats_block_cycles_sum;
+    uint32_t stats_saturations;
+#endif
 } analog_mic;
 
 static void analog_dma_handler();
 
 int analog_microphone_init(const struct analog_microphone_config* config) {
+    return analog_microphone_init_static(config, NULL, NULL);
+}
+
+int analog_microphone_init_static(const struct analog_microphone_config* config, uint16_t* raw_buffers, int16_t* blocks) {
     memset(&analog_mic, 0x00, sizeof(analog_mic));
     memcpy(&analog_mic.config, config, sizeof(analog_mic.config));
 
+    analog_mic.dma_channel = -1;
+    analog_mic.dma_control_channel = -1;
+
     if (config->gpio < 26 || config->gpio > 29) {
         return -1;
     }
@@ -43,132 +79,176 @@ int analog_microphone_init(const struct analog_microphone_config* config) {
 
     analog_mic.buffer_size = config->sample_buffer_size;
     analog_mic.bias = ((int16_t)((config->bias_voltage * 4095) / 3.3));
+    analog_mic.raw_buffer_count = config->raw_buffer_count ? config->raw_buffer_count : 2;
+
+    // the control channel reads the buffer addresses in ring mode
+    if (analog_mic.raw_buffer_count < 2 || analog_mic.raw_buffer_count > ANALOG_RAW_BUFFER_COUNT_MAX ||
+        (ANALOG_MICROPHONE_CHAINED_DMA && (analog_mic.raw_buffer_count & (analog_mic.raw_buffer_count - 1)))) {
+        return -1;
+    }
+
+    if (raw_buffers == NULL) {
+        raw_buffers = malloc(analog_mic.raw_buffer_count * raw_buffer_size);
+        if (raw_buffers == NULL) {
+            return -1;
+        }
+
+        analog_mic.raw_buffers_allocated = true;
+    }
+
+    for (uint i = 0; i < analog_mic.raw_buffer_count; i++) {
+        analog_mic.raw_buffer[i] = raw_buffers + i * config->sample_buffer_size;
+        analog_mic.dma_write_addr[i] = analog_mic.raw_buffer[i];
+    }
 
-    for (int i = 0; i < ANALOG_RAW_BUFFER_COUNT; i++) {
-        analog_mic.raw_buffer[i] = malloc(raw_buffer_size);
-        if (analog_mic.raw_buffer[i] == NULL) {
-            analog_microphone_deinit();
+    if (config->block_count) {
+        if (blocks == NULL) {
+            blocks = malloc(config->block_count * config->sample_buffer_size * sizeof(blocks[0]));
+            if (blocks == NULL) {
+                analog_microphone_deinit();
 
-            return -1;   
+                return -1;
+            }
+
+            analog_mic.blocks_allocated = true;
         }
+
+        analog_mic.blocks = blocks;
     }
 
-    analog_mic.dma_channel = dma_claim_unused_channel(true);
+    analog_mic.dma_channel = mic_hal_dma_claim();
     if (analog_mic.dma_channel < 0) {
         analog_microphone_deinit();
 
         return -1;
     }
 
-    float clk_div = (clock_get_hz(clk_adc) / (1.0 * config->sample_rate)) - 1;
-
-    dma_channel_config dma_channel_cfg = dma_channel_get_default_config(analog_mic.dma_channel);
+#if ANALOG_MICROPHONE_CHAINED_DMA
+    analog_mic.dma_control_channel = mic_hal_dma_claim();
+    if (analog_mic.dma_control_channel < 0) {
+        analog_microphone_deinit();
 
-    channel_config_set_transfer_data_size(&dma_channel_cfg, DMA_SIZE_16);
-    channel_config_set_read_increment(&dma_channel_cfg, false);
-    channel_config_set_write_increment(&dma_channel_cfg, true);
-    channel_config_set_dreq(&dma_channel_cfg, DREQ_ADC);
+        return -1;
+    }
+#endif
 
-    analog_mic.dma_irq = DMA_IRQ_0;
+    analog_mic.dma_irq = 0;
 
-    dma_channel_configure(
+    mic_hal_dma_capture_init(
         analog_mic.dma_channel,
-        &dma_channel_cfg,
-        analog_mic.raw_buffer[0],
-        &adc_hw->fifo,
+        analog_mic.dma_control_channel,
+        mic_hal_adc_fifo(),
+        mic_hal_adc_dreq(),
+        sizeof(analog_mic.raw_buffer[0][0]),
+        false,
         analog_mic.buffer_size,
-        false
+        analog_mic.dma_write_addr,
+        analog_mic.raw_buffer_count
     );
 
-    adc_gpio_init(config->gpio);
-
-    adc_init();
-    adc_select_input(config->gpio - 26);
-    adc_fifo_setup(
-        true,    // Write each completed conversion to the sample FIFO
-        true,    // Enable DMA data request (DREQ)
-        1,       // DREQ (and IRQ) asserted when at least 1 sample present
-        false,   // We won't see the ERR bit because of 8 bit reads; disable.
-        false    // Don't shift each sample to 8 bits when pushing to FIFO
-    );
+    mic_hal_adc_init(config->gpio, config->sample_rate);
 
-    adc_set_clkdiv(clk_div);
+    return 0;
 }
 
 void analog_microphone_deinit() {
-    for (int i = 0; i < ANALOG_RAW_BUFFER_COUNT; i++) {
-        if (analog_mic.raw_buffer[i]) {
-            free(analog_mic.raw_buffer[i]);
+    if (analog_mic.raw_buffers_allocated) {
+        free(analog_mic.raw_buffer[0]);
 
-            analog_mic.raw_buffer[i] = NULL;
-        }
+        analog_mic.raw_buffers_allocated = false;
+    }
+
+    for (int i = 0; i < ANALOG_RAW_BUFFER_COUNT_MAX; i++) {
+        analog_mic.raw_buffer[i] = NULL;
+    }
+
+    if (analog_mic.blocks_allocated) {
+        free(analog_mic.blocks);
+
+        analog_mic.blocks_allocated = false;
     }
 
+    analog_mic.blocks = NULL;
+
     if (analog_mic.dma_channel > -1) {
-        dma_channel_unclaim(analog_mic.dma_channel);
+        mic_hal_dma_unclaim(analog_mic.dma_channel);
 
         analog_mic.dma_channel = -1;
     }
+
+    if (analog_mic.dma_control_channel > -1) {
+        mic_hal_dma_unclaim(analog_mic.dma_control_channel);
+
+        analog_mic.dma_control_channel = -1;
+    }
 }
 
 int analog_microphone_start() {
-    irq_set_enabled(analog_mic.dma_irq, true);
-    irq_set_exclusive_handler(analog_mic.dma_irq, analog_dma_handler);
-
-    if (analog_mic.dma_irq == DMA_IRQ_0) {
-        dma_channel_set_irq0_enabled(analog_mic.dma_channel, true);
-    } else if (analog_mic.dma_irq == DMA_IRQ_1) {
-        dma_channel_set_irq1_enabled(analog_mic.dma_channel, true);
-    } else {
+    if (analog_mic.dma_irq >= MIC_HAL_DMA_IRQ_COUNT) {
         return -1;
     }
 
-    analog_mic.raw_buffer_write_index = 0;
-    analog_mic.raw_buffer_read_index = 0;
+    mic_hal_irq_add_handler(analog_mic.dma_irq, analog_dma_handler);
+    mic_hal_dma_set_irq_enabled(analog_mic.dma_channel, analog_mic.dma_irq, true);
 
-    dma_channel_transfer_to_buffer_now(
-        analog_mic.dma_channel,
-        analog_mic.raw_buffer[0],
-        analog_mic.buffer_size
-    );
+    analog_mic.raw_buffer_produced = 0;
+    analog_mic.raw_buffer_consumed = 0;
+    analog_mic.raw_buffer_offset = 0;
+
+    mic_hal_dma_capture_start(analog_mic.dma_channel, analog_mic.dma_control_channel, analog_mic.dma_write_addr, analog_mic.buffer_size);
+
+    mic_hal_adc_run(true); // start running the adc
 
-    adc_run(true); // start running the adc
+    return 0;
 }
 
 void analog_microphone_stop() {
-    adc_run(false); // stop running the adc
+    mic_hal_adc_run(false); // stop running the adc
 
-    dma_channel_abort(analog_mic.dma_channel);
+    mic_hal_dma_set_irq_enabled(analog_mic.dma_channel, analog_mic.dma_irq, false);
 
-    if (analog_mic.dma_irq == DMA_IRQ_0) {
-        dma_channel_set_irq0_enabled(analog_mic.dma_channel, false);
-    } else if (analog_mic.dma_irq == DMA_IRQ_1) {
-        dma_channel_set_irq1_enabled(analog_mic.dma_channel, false);
-    }
+    mic_hal_dma_capture_stop(analog_mic.dma_channel, analog_mic.dma_control_channel);
 
-    irq_set_enabled(analog_mic.dma_irq, false);
+    mic_hal_irq_remove_handler(analog_mic.dma_irq, analog_dma_handler);
 }
 
 static void analog_dma_handler() {
-    // clear IRQ
-    if (analog_mic.dma_irq == DMA_IRQ_0) {
-        dma_hw->ints0 = (1u << analog_mic.dma_channel);
-    } else if (analog_mic.dma_irq == DMA_IRQ_1) {
-        dma_hw->ints1 = (1u << analog_mic.dma_channel);
+    // shared with other DMA users of the IRQ
+    if (!mic_hal_dma_irq_clear(analog_mic.dma_irq, analog_mic.dma_channel)) {
+        return;
+    }
+
+#if ANALOG_MICROPHONE_STATS
+    // samples since the buffer was full: in the next buffer, or waiting in
+    // the FIFO as the channel is stopped
+#if ANALOG_MICROPHONE_CHAINED_DMA
+    uint32_t remaining = mic_hal_dma_remaining(analog_mic.dma_channel);
+    uint32_t latency = remaining ? (analog_mic.buffer_size - remaining) : 0;
+#else
+    uint32_t latency = mic_hal_adc_fifo_level();
+#endif
+
+    if (latency > analog_mic.stats_isr_latency_max) {
+        analog_mic.stats_isr_latency_max = latency;
     }
+    analog_mic.stats_isr_latency_sum += latency;
+    analog_mic.stats_isr_count++;
+#endif
+
+    // the next buffer, the control channel already started the dma on it
+    uint32_t produced = analog_mic.raw_buffer_produced + 1;
 
-    // get the current buffer index
-    analog_mic.raw_buffer_read_index = analog_mic.raw_buffer_write_index;
+    analog_mic.raw_buffer_produced = produced;
 
-    // get the next capture index to send the dma to start
-    analog_mic.raw_buffer_write_index = (analog_mic.raw_buffer_write_index + 1) % ANALOG_RAW_BUFFER_COUNT;
+    // it still holds the oldest unread buffer
+    if (produced - analog_mic.raw_buffer_consumed >= analog_mic.raw_buffer_count) {
+        analog_mic.raw_buffer_overruns++;
+    }
 
+#if !ANALOG_MICROPHONE_CHAINED_DMA
     // give the channel a new buffer to write to and re-trigger it
-    dma_channel_transfer_to_buffer_now(
-        analog_mic.dma_channel,
-        analog_mic.raw_buffer[analog_mic.raw_buffer_write_index],
-        analog_mic.buffer_size
-    );
+    mic_hal_dma_capture_next(analog_mic.dma_channel, analog_mic.raw_buffer[produced % analog_mic.raw_buffer_count], analog_mic.buffer_size);
+#endif
 
     if (analog_mic.samples_ready_handler) {
         analog_mic.samples_ready_handler();
@@ -180,23 +260,144 @@ void analog_microphone_set_samples_ready_handler(analog_samples_ready_handler_t
 }
 
 int analog_microphone_read(int16_t* buffer, size_t samples) {
-    if (samples > analog_mic.config.sample_buffer_size) {
-        samples = analog_mic.config.sample_buffer_size;
+    uint32_t produced = analog_mic.raw_buffer_produced;
+    uint32_t consumed = analog_mic.raw_buffer_consumed;
+    size_t offset = analog_mic.raw_buffer_offset;
+    int16_t* out = buffer;
+    int16_t bias = analog_mic.bias;
+    size_t read = 0;
+
+    // skip to the oldest buffer the DMA is not writing to, the rest of a
+    // partly read one is lost
+    if (produced - consumed >= analog_mic.raw_buffer_count) {
+        analog_mic.raw_buffers_dropped += produced - consumed - (analog_mic.raw_buffer_count - 1);
+
+        consumed = produced - (analog_mic.raw_buffer_count - 1);
+        offset = 0;
+    }
+
+    while (samples > 0 && consumed != produced) {
+        uint16_t* in = analog_mic.raw_buffer[consumed % analog_mic.raw_buffer_count] + offset;
+        size_t buffer_samples = analog_mic.config.sample_buffer_size - offset;
+
+        if (buffer_samples > samples) {
+            buffer_samples = samples;
+        }
+
+#if ANALOG_MICROPHONE_STATS
+        mic_hal_cycles_init();
+
+        uint32_t block_start = mic_hal_cycles();
+        uint32_t saturations = 0;
+#endif
+
+        for (size_t i = 0; i < buffer_samples; i++) {
+#if ANALOG_MICROPHONE_STATS
+            saturations += (*in == 0 || *in >= 4095);
+#endif
+            *out++ = *in++ - bias;
+        }
+
+#if ANALOG_MICROPHONE_STATS
+        uint32_t block_cycles = mic_hal_cycles_since(block_start);
+
+        if (block_cycles > analog_mic.stats_block_cycles_max) {
+            analog_mic.stats_block_cycles_max = block_cycles;
+        }
+        analog_mic.stats_block_cycles_sum += block_cycles;
+        analog_mic.stats_buffers_decoded++;
+        analog_mic.stats_saturations += saturations;
+#endif
+
+        offset += buffer_samples;
+        read += buffer_samples;
+        samples -= buffer_samples;
+
+        if (offset == analog_mic.config.sample_buffer_size) {
+            consumed++;
+            offset = 0;
+        }
     }
 
-    if (analog_mic.raw_buffer_write_index == analog_mic.raw_buffer_read_index) {
-        return 0;
+    analog_mic.raw_buffer_consumed = consumed;
+    analog_mic.raw_buffer_offset = offset;
+
+    return read;
+}
+
+const int16_t* analog_microphone_acquire(size_t* samples) {
+    uint block_count = analog_mic.config.block_count;
+
+    if (analog_mic.blocks_acquired - analog_mic.blocks_released >= block_count) {
+        return NULL;
     }
 
-    uint16_t* in = analog_mic.raw_buffer[analog_mic.raw_buffer_read_index];
-    int16_t* out = buffer;
-    int16_t bias = analog_mic.bias;
+    int16_t* block = analog_mic.blocks + (analog_mic.blocks_acquired % block_count) * analog_mic.buffer_size;
 
-    analog_mic.raw_buffer_read_index++;
+    int read = analog_microphone_read(block, analog_mic.buffer_size);
 
-    for (int i = 0; i < samples; i++) {
-        *out++ = *in++ - bias;
+    if (read == 0) {
+        return NULL;
     }
 
-    return samples;
+    analog_mic.blocks_acquired++;
+    *samples = read;
+
+    return block;
+}
+
+void analog_microphone_release() {
+    if (analog_mic.blocks_released != analog_mic.blocks_acquired) {
+        analog_mic.blocks_released++;
+    }
+}
+
+uint analog_microphone_get_raw_buffers_available() {
+    uint32_t available = analog_mic.raw_buffer_produced - analog_mic.raw_buffer_consumed;
+
+    return (available < analog_mic.raw_buffer_count) ? available : (analog_mic.raw_buffer_count - 1);
+}
+
+uint32_t analog_microphone_get_overruns() {
+    return analog_mic.raw_buffer_overruns;
+}
+
+uint32_t analog_microphone_get_dropped_buffers() {
+    return analog_mic.raw_buffers_dropped;
+}
+
+void analog_microphone_get_stats(struct analog_microphone_stats* stats) {
+    memset(stats, 0x00, sizeof(*stats));
+
+    stats->buffers_captured = analog_mic.raw_buffer_produced;
+    stats->buffers_decoded = analog_mic.raw_buffer_consumed - analog_mic.raw_buffers_dropped;
+    stats->overruns = analog_mic.raw_buffer_overruns;
+    stats->dropped_buffers = analog_mic.raw_buffers_dropped;
+
+#if ANALOG_MICROPHONE_STATS
+    stats->isr_latency_max_us = ((uint64_t)analog_mic.stats_isr_latency_max * 1000000) / analog_mic.config.sample_rate;
+    if (analog_mic.stats_isr_count) {
+        stats->isr_latency_avg_us = (analog_mic.stats_isr_latency_sum * 1000000) / ((uint64_t)analog_mic.config.sample_rate * analog_mic.stats_isr_count);
+    }
+
+    stats->block_cycles_max = analog_mic.stats_block_cycles_max;
+    if (analog_mic.stats_buffers_decoded) {
+        stats->block_cycles_avg = analog_mic.stats_block_cycles_sum / analog_mic.stats_buffers_decoded;
+    }
+
+    stats->saturations = analog_mic.stats_saturations;
+#endif
+}
+
+// only the conversion and latency counters, the buffer counts run on
+void analog_microphone_reset_stats() {
+#if ANALOG_MICROPHONE_STATS
+    analog_mic.stats_isr_latency_max = 0;
+    analog_mic.stats_isr_latency_sum = 0;
+    analog_mic.stats_isr_count = 0;
+    analog_mic.stats_buffers_decoded = 0;
+    analog_mic.stats_block_cycles_max = 0;
+    analog_mic.stats_block_cycles_sum = 0;
+    analog_mic.stats_saturations = 0;
+#endif
 }
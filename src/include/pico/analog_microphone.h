@@ -8,6 +8,20 @@
 #ifndef _PICO_ANALOG_MICROPHONE_H_
 #define _PICO_ANALOG_MICROPHONE_H_
 
+#include "pico/microphone_hal.h"
+
+// capture and conversion counters, see struct analog_microphone_stats
+#ifndef ANALOG_MICROPHONE_STATS
+#define ANALOG_MICROPHONE_STATS 1
+#endif
+
+// Buffer sizes for analog_microphone_init_static(): samples of buffer_ms,
+// of raw_buffer_count raw buffers and of block_count blocks. The raw
+// buffers can go in a bank of their own with MIC_HAL_SRAM_BANK_X() or _Y().
+#define ANALOG_MICROPHONE_BUFFER_SAMPLES(sample_rate, buffer_ms) ((sample_rate) * (buffer_ms) / 1000)
+#define ANALOG_MICROPHONE_RAW_POOL_SIZE(sample_buffer_size, raw_buffer_count) ((sample_buffer_size) * (raw_buffer_count))
+#define ANALOG_MICROPHONE_BLOCK_POOL_SIZE(sample_buffer_size, block_count) ((sample_buffer_size) * (block_count))
+
 typedef void (*analog_samples_ready_handler_t)(void);
 
 struct analog_microphone_config {
@@ -15,9 +29,34 @@ struct analog_microphone_config {
     float bias_voltage;
     uint sample_rate;
     uint sample_buffer_size;
+    // raw buffers the DMA fills in turn, 2 (or 0) to 8, a power of two with
+    // ANALOG_MICROPHONE_CHAINED_DMA
+    uint raw_buffer_count;
+    // converted blocks of sample_buffer_size samples
+    // analog_microphone_acquire() lends out, 0 for none
+    uint block_count;
+};
+
+struct analog_microphone_stats {
+    uint32_t buffers_captured;
+    uint32_t buffers_decoded;
+    uint32_t overruns;
+    uint32_t dropped_buffers;
+    // from a raw buffer filling up to its DMA IRQ handler running
+    uint32_t isr_latency_max_us;
+    uint32_t isr_latency_avg_us;
+    // SysTick cycles converting a raw buffer
+    uint32_t block_cycles_max;
+    uint32_t block_cycles_avg;
+    // samples at either end of the ADC range
+    uint32_t saturations;
 };
 
 int analog_microphone_init(const struct analog_microphone_config* config);
+// Without allocating: raw_buffers holds ANALOG_MICROPHONE_RAW_POOL_SIZE()
+// samples, blocks ANALOG_MICROPHONE_BLOCK_POOL_SIZE() samples or NULL
+// without block_count. NULL allocates them as analog_microphone_init() does.
+int analog_microphone_init_static(const struct analog_microphone_config* config, uint16_t* raw_buffers, int16_t* blocks);
 void analog_microphone_deinit();
 
 int analog_microphone_start();
@@ -27,4 +66,18 @@ void analog_microphone_set_samples_ready_handler(analog_samples_ready_handler_t
 
 int analog_microphone_read(int16_t* buffer, size_t samples);
 
+// Up to sample_buffer_size queued samples converted into a free block of the
+// pool, as analog_microphone_read() would, and lent out until released,
+// oldest first. NULL when nothing is queued or every block is lent out.
+const int16_t* analog_microphone_acquire(size_t* samples);
+void analog_microphone_release();
+
+uint analog_microphone_get_raw_buffers_available();
+uint32_t analog_microphone_get_overruns();
+uint32_t analog_microphone_get_dropped_buffers();
+
+// all zero without ANALOG_MICROPHONE_STATS but for the buffer counts
+void analog_microphone_get_stats(struct analog_microphone_stats* stats);
+void analog_microphone_reset_stats();
+
 #endif
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _PICO_MICROPHONE_HAL_H_
+#define _PICO_MICROPHONE_HAL_H_
+
+// The hardware the microphone drivers use: DMA ring capture, IRQs, the PDM
+// state machine and the ADC. microphone_hal_rp2040.c implements it with the
+// Pico SDK, microphone_hal_sim.c (built with MICROPHONE_HAL_SIM) simulates it
+// on a host so the drivers run without a board.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if MICROPHONE_HAL_SIM
+
+typedef unsigned int uint;
+
+// a PIO block of the simulation, only compared and passed back
+typedef struct mic_hal_sim_pio* PIO;
+
+extern struct mic_hal_sim_pio mic_hal_sim_pio0;
+extern struct mic_hal_sim_pio mic_hal_sim_pio1;
+
+#define pio0 (&mic_hal_sim_pio0)
+#define pio1 (&mic_hal_sim_pio1)
+
+#else
+
+#include "hardware/pio.h"
+#include "hardware/structs/systick.h"
+
+#endif
+
+// Places a buffer in SRAM4 (X) or SRAM5 (Y), banks of 4 kB outside the
+// striped SRAM0 to 3, so the DMA writing it does not contend with the cores
+// running from the striped banks. The stack of core1 (X) or core0 (Y) is at
+// the top of the bank, leaving about 2 kB. No effect in the simulation.
+#if MICROPHONE_HAL_SIM
+#define MIC_HAL_SRAM_BANK_X(group)
+#define MIC_HAL_SRAM_BANK_Y(group)
+#else
+#define MIC_HAL_SRAM_BANK_X(group) __scratch_x(group)
+#define MIC_HAL_SRAM_BANK_Y(group) __scratch_y(group)
+#endif
+
+// DMA IRQ lines, 0 and 1
+#define MIC_HAL_DMA_IRQ_COUNT 2
+
+typedef void (*mic_hal_irq_handler_t)(void);
+
+// claimed channel, or -1
+int mic_hal_dma_claim();
+void mic_hal_dma_unclaim(int channel);
+
+// Sets channel up to move transfer_count transfers of transfer_size bytes
+// (1, 2 or 4) per buffer from the FIFO at src, paced by dreq, with their
+// byte order reversed when bswap is set. With a
+// control_channel the buffers are write_addr[0] to write_addr[buffer_count -
+// 1] in turn without stopping, write_addr then has to stay valid and be
+// aligned to buffer_count (a power of two) pointers. With control_channel
+// -1 the channel stops after every buffer.
+void mic_hal_dma_capture_init(int channel, int control_channel, const volatile void* src, uint dreq,
+                              uint transfer_size, bool bswap, uint transfer_count, void** write_addr, uint buffer_count);
+// starts on write_addr[0] again
+void mic_hal_dma_capture_start(int channel, int control_channel, void** write_addr, uint transfer_count);
+// restarts a channel without control channel on buffer
+void mic_hal_dma_capture_next(int channel, void* buffer, uint transfer_count);
+void mic_hal_dma_capture_stop(int channel, int control_channel);
+// transfers left in the current buffer
+uint32_t mic_hal_dma_remaining(int channel);
+
+void mic_hal_dma_set_irq_enabled(int channel, uint irq, bool enabled);
+// true and acknowledged when channel raised irq
+bool mic_hal_dma_irq_clear(uint irq, int channel);
+
+// handlers of an IRQ line are shared, the line is enabled while it has any
+void mic_hal_irq_add_handler(uint irq, mic_hal_irq_handler_t handler);
+void mic_hal_irq_remove_handler(uint irq, mic_hal_irq_handler_t handler);
+
+uint32_t mic_hal_interrupts_disable();
+void mic_hal_interrupts_restore(uint32_t status);
+
+// PDM state machine clocking data_pins microphones from gpio_data (two per
+// pin when stereo) at clock_hz, returns its program offset or -1. It pushes
+// 8 clocks of every pin, up to 32 bits, or 32 bits with push_32, and drops
+// pushes while its FIFO is full instead of stopping the clock.
+int mic_hal_pdm_init(PIO pio, uint sm, uint gpio_data, uint data_pins, uint gpio_clk, bool stereo, uint clock_hz, bool push_32);
+void mic_hal_pdm_deinit(PIO pio, bool stereo, int offset);
+// stops it at the start of its program with empty FIFOs
+void mic_hal_pdm_reset(PIO pio, uint sm, int offset);
+void mic_hal_pdm_set_enabled(PIO pio, uint sm, bool enabled);
+// state machines of sm_mask, with their clock dividers in phase
+void mic_hal_pdm_enable_in_sync(PIO pio, uint32_t sm_mask);
+const volatile void* mic_hal_pdm_fifo(PIO pio, uint sm);
+uint mic_hal_pdm_dreq(PIO pio, uint sm);
+uint mic_hal_pdm_fifo_level(PIO pio, uint sm);
+
+// ADC converting gpio (26 to 29) at sample_rate
+void mic_hal_adc_init(uint gpio, uint sample_rate);
+void mic_hal_adc_run(bool run);
+const volatile void* mic_hal_adc_fifo();
+uint mic_hal_adc_dreq();
+uint mic_hal_adc_fifo_level();
+
+#if MICROPHONE_HAL_SIM
+
+// host nanoseconds
+void mic_hal_cycles_init();
+uint32_t mic_hal_cycles();
+uint32_t mic_hal_cycles_since(uint32_t start);
+
+// Simulation control. PDM inputs hold the bits the state machine shifts in,
+// from the top bit of each byte: the bit stream of a mono microphone, or
+// the bits of every clock in turn as "in pins" shifts them, the highest pin
+// first and the low clock phase before the high one. The simulation
+// pushes them as the state machine does and the DMA byte swaps them like the
+// hardware, so the raw buffers get what they would on a Pico. ADC inputs
+// hold 16-bit samples in memory order. Inputs play from the start every time
+// their source is enabled, then loop or continue as zeros. Source clocks run at speed times real time and the DMA
+// IRQ handlers are called from a thread after the injected latency, with the
+// interrupts of mic_hal_interrupts_disable() masked.
+void mic_hal_sim_set_pdm_input(PIO pio, uint sm, const void* data, size_t size, bool loop);
+void mic_hal_sim_set_adc_input(const void* data, size_t size, bool loop);
+// files read into memory, -1 when unreadable
+int mic_hal_sim_load_pdm_input(PIO pio, uint sm, const char* path, bool loop);
+int mic_hal_sim_load_adc_input(const char* path, bool loop);
+
+void mic_hal_sim_set_speed(double speed);
+// uniformly between min_us and max_us of simulated time
+void mic_hal_sim_set_irq_latency(uint32_t min_us, uint32_t max_us, unsigned seed);
+
+uint64_t mic_hal_sim_time_us();
+void mic_hal_sim_sleep_us(uint64_t us);
+
+struct mic_hal_sim_stats {
+    uint32_t dma_buffers;
+    uint32_t irqs;
+    // buffers completed while the IRQ of the previous one was still pending
+    uint32_t irqs_merged;
+    // new FIFO entries dropped while the FIFO was full, waiting for a
+    // channel without control channel to be restarted
+    uint32_t fifo_overflows;
+};
+
+void mic_hal_sim_get_stats(struct mic_hal_sim_stats* stats);
+
+// stops the simulation thread, e.g. before exit
+void mic_hal_sim_shutdown();
+
+#else
+
+// SysTick of the calling core counting down every cycle, left alone when
+// already running
+static inline void mic_hal_cycles_init() {
+    if (!(systick_hw->csr & 0x1)) {
+        systick_hw->rvr = 0x00ffffff;
+        systick_hw->cvr = 0;
+        systick_hw->csr = 0x5;
+    }
+}
+
+static inline uint32_t mic_hal_cycles() {
+    return systick_hw->cvr;
+}
+
+// cycles since start, up to 2^24
+static inline uint32_t mic_hal_cycles_since(uint32_t start) {
+    return (start - systick_hw->cvr) & 0x00ffffff;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _PICO_PCM_RING_H_
+#define _PICO_PCM_RING_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Single producer, single consumer ring of PCM samples, e.g. written by a
+// samples ready handler and read by the main loop, a USB callback or the
+// other core. No locks: the producer only writes head, the consumer only
+// tail, each published with release and read with acquire ordering.
+struct pcm_ring {
+    int16_t* buffer;
+    uint32_t size;
+    // free running sample counts, head - tail samples are queued
+    uint32_t head;
+    uint32_t tail;
+};
+
+// size is in samples and a power of two
+int pcm_ring_init(struct pcm_ring* ring, int16_t* buffer, size_t size);
+void pcm_ring_reset(struct pcm_ring* ring);
+
+size_t pcm_ring_available(const struct pcm_ring* ring);
+size_t pcm_ring_free(const struct pcm_ring* ring);
+
+// producer side, writes what fits and returns the count
+size_t pcm_ring_write(struct pcm_ring* ring, const int16_t* samples, size_t count);
+
+// consumer side: what is queued up to count, exactly count or nothing, and
+// waiting for count
+size_t pcm_ring_read(struct pcm_ring* ring, int16_t* samples, size_t count);
+bool pcm_ring_read_exact(struct pcm_ring* ring, int16_t* samples, size_t count);
+size_t pcm_ring_read_blocking(struct pcm_ring* ring, int16_t* samples, size_t count);
+
+// In place: the free or queued samples up to the end of the buffer, count
+// set to how many, for decoding straight into the ring or sending from it.
+// Commit the samples written, release the samples used.
+int16_t* pcm_ring_write_acquire(struct pcm_ring* ring, size_t* count);
+void pcm_ring_write_commit(struct pcm_ring* ring, size_t count);
+const int16_t* pcm_ring_read_acquire(struct pcm_ring* ring, size_t* count);
+void pcm_ring_read_release(struct pcm_ring* ring, size_t count);
+
+#endif
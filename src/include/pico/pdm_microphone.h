@@ -2,13 +2,61 @@
  * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
  *
  * SPDX-License-Identifier: Apache-2.0
- * 
+ *
  */
 
 #ifndef _PICO_PDM_MICROPHONE_H_
 #define _PICO_PDM_MICROPHONE_H_
 
-#include "hardware/pio.h"
+#include "pico/microphone_hal.h"
+
+#include "OpenPDM2PCM/OpenPDMFilter.h"
+
+// most raw buffers queued by one instance, raw_buffer_count in the config
+// picks how many are used
+#ifndef PDM_MICROPHONE_RAW_BUFFER_COUNT_MAX
+#define PDM_MICROPHONE_RAW_BUFFER_COUNT_MAX 8
+#endif
+
+// capture with a second DMA channel reloading the write address of the first
+// one from a list of the raw buffers, so it never stops and waits for the IRQ
+#ifndef PDM_MICROPHONE_CHAINED_DMA
+#define PDM_MICROPHONE_CHAINED_DMA 1
+#endif
+
+#if PDM_MICROPHONE_CHAINED_DMA && (PDM_MICROPHONE_RAW_BUFFER_COUNT_MAX & (PDM_MICROPHONE_RAW_BUFFER_COUNT_MAX - 1))
+#error "PDM_MICROPHONE_RAW_BUFFER_COUNT_MAX must be a power of two with PDM_MICROPHONE_CHAINED_DMA"
+#endif
+
+// the state machine pushes 32 bits and the DMA moves words, a quarter of the
+// FIFO entries and bus transfers of 8-bit pushes with one microphone and half
+// of them with two. pdm_mic_init() fails unless sample_buffer_size *
+// PDM_DECIMATION / 8 is a multiple of 4.
+#ifndef PDM_MICROPHONE_PUSH_32
+#define PDM_MICROPHONE_PUSH_32 1
+#endif
+
+// capture and decode counters, see struct pdm_microphone_stats
+#ifndef PDM_MICROPHONE_STATS
+#define PDM_MICROPHONE_STATS 1
+#endif
+
+// PDM clocks per sample, set by PICO_PDM_MICROPHONE_DECIMATION
+#ifndef PDM_DECIMATION
+#define PDM_DECIMATION 64
+#endif
+
+// Buffer sizes for pdm_mic_init_static(), sample_buffer_size counting every
+// channel: samples of buffer_ms, bytes of raw_buffer_count raw buffers and
+// samples of block_count blocks
+#define PDM_MICROPHONE_BUFFER_SAMPLES(sample_rate, channels, buffer_ms) (((sample_rate) * (buffer_ms) / 1000) * (channels))
+#define PDM_MICROPHONE_RAW_POOL_SIZE(sample_buffer_size, raw_buffer_count) ((sample_buffer_size) * (PDM_DECIMATION / 8) * (raw_buffer_count))
+#define PDM_MICROPHONE_BLOCK_POOL_SIZE(sample_buffer_size, block_count) ((sample_buffer_size) * (block_count))
+
+// channels of one instance, each has its own filter state
+#ifndef PDM_MICROPHONE_MAX_CHANNELS
+#define PDM_MICROPHONE_MAX_CHANNELS 8
+#endif
 
 typedef void (*pdm_samples_ready_handler_t)(void);
 
@@ -18,10 +66,152 @@ struct pdm_microphone_config {
     PIO pio;
     uint pio_sm;
     uint sample_rate;
+    // samples of every channel per raw buffer, a multiple of channels, and
+    // with PDM_MICROPHONE_PUSH_32 of raw buffers in whole words
+    // (sample_buffer_size * PDM_DECIMATION / 8 a multiple of 4)
     uint sample_buffer_size;
+    // 1 (or 0) for mono, 2 for two microphones sharing gpio_data, sampled on
+    // both clock edges: the one with SEL to GND is the first (left) channel
+    uint channels;
+    // data pins from gpio_data up sharing gpio_clk and one state machine,
+    // 1 (or 0), 2, 4 or 8 with up to 8 channels in total
+    uint data_pins;
+    // raw buffers of sample_buffer_size samples the DMA fills in turn, 2 (or
+    // 0) to PDM_MICROPHONE_RAW_BUFFER_COUNT_MAX, a power of two with
+    // PDM_MICROPHONE_CHAINED_DMA: up to raw_buffer_count - 1 filled buffers
+    // wait for pdm_mic_read() before the oldest is overwritten
+    uint raw_buffer_count;
+    // most samples of every channel per filter call, 0 for a millisecond
+    // (sample_rate / 1000). Longer frames cost less per sample at high
+    // sample rates.
+    uint frame_samples;
+    // decoded blocks of sample_buffer_size samples pdm_mic_acquire() lends
+    // out, 0 for none
+    uint block_count;
 };
 
+struct pdm_microphone_stats {
+    uint32_t buffers_captured;
+    uint32_t buffers_decoded;
+    uint32_t overruns;
+    uint32_t dropped_buffers;
+    // from a raw buffer filling up to its DMA IRQ handler running
+    uint32_t isr_latency_max_us;
+    uint32_t isr_latency_avg_us;
+    // SysTick cycles of the core decoding, per frame (frame_samples of every
+    // channel), per Open_PDM_Filter() call in it and per decoded raw buffer
+    // (or part of one)
+    uint32_t frame_cycles_max;
+    uint32_t frame_cycles_avg;
+    uint32_t filter_cycles_avg;
+    uint32_t block_cycles_max;
+    uint32_t block_cycles_avg;
+    // output samples clipped to full scale, with the filter built with
+    // USE_STATS
+    uint32_t saturations;
+};
+
+struct pdm_microphone;
+
+typedef void (*pdm_mic_samples_ready_handler_t)(struct pdm_microphone* mic);
+
+// One capture instance: a state machine, DMA channel, buffers and filter
+// state of its own. Allocated by the caller, the fields are private. With
+// PDM_MICROPHONE_CHAINED_DMA init fails unless dma_write_addr keeps its
+// alignment, as in a static instance or one from aligned_alloc() with
+// _Alignof(struct pdm_microphone).
+struct pdm_microphone {
+    struct pdm_microphone_config config;
+    int dma_channel;
+    int dma_control_channel;
+    uint8_t* raw_buffer[PDM_MICROPHONE_RAW_BUFFER_COUNT_MAX];
+    // raw buffers and blocks allocated by pdm_mic_init(), not the caller
+    bool raw_buffers_allocated;
+    bool blocks_allocated;
+    // the raw buffers, read by the control channel in ring mode, so aligned
+    // to its size
+    void* dma_write_addr[PDM_MICROPHONE_RAW_BUFFER_COUNT_MAX] __attribute__((aligned(PDM_MICROPHONE_RAW_BUFFER_COUNT_MAX * sizeof(void*))));
+    uint raw_buffer_count;
+    // buffers filled by the DMA and read, free running: raw buffer n % count
+    // holds buffer n, the DMA fills buffer produced
+    volatile uint32_t raw_buffer_produced;
+    volatile uint32_t raw_buffer_consumed;
+    // samples already read from buffer consumed
+    uint raw_buffer_offset;
+    // buffers the DMA started overwriting before they were read, and unread
+    // buffers pdm_mic_read() skipped because of it
+    volatile uint32_t raw_buffer_overruns;
+    uint32_t raw_buffers_dropped;
+#if PDM_MICROPHONE_STATS
+    // latencies in DMA transfers
+    uint32_t stats_isr_latency_max;
+    uint64_t stats_isr_latency_sum;
+    uint32_t stats_isr_count;
+    uint32_t stats_buffers_decoded;
+    uint32_t stats_frames;
+    uint32_t stats_frame_cycles_max;
+    uint64_t stats_frame_cycles_sum;
+    uint32_t stats_block_cycles_max;
+    uint64_t stats_block_cycles_sum;
+#endif
+    uint raw_buffer_size;
+    uint dma_transfer_count;
+    uint dma_irq;
+    // of the loaded program, or -1
+    int pio_sm_offset;
+    uint channels;
+    uint channel_offset[PDM_MICROPHONE_MAX_CHANNELS];
+    TPDMFilter_InitStruct filter[PDM_MICROPHONE_MAX_CHANNELS];
+    uint16_t filter_volume;
+    // the block pool, blocks acquired and released, free running
+    int16_t* blocks;
+    uint32_t blocks_acquired;
+    uint32_t blocks_released;
+    pdm_mic_samples_ready_handler_t samples_ready_handler;
+    struct pdm_microphone* next;
+};
+
+int pdm_mic_init(struct pdm_microphone* mic, const struct pdm_microphone_config* config);
+// Without allocating: raw_buffers holds PDM_MICROPHONE_RAW_POOL_SIZE() bytes
+// aligned to 4, blocks PDM_MICROPHONE_BLOCK_POOL_SIZE() samples or NULL
+// without block_count. NULL allocates them as pdm_mic_init() does.
+int pdm_mic_init_static(struct pdm_microphone* mic, const struct pdm_microphone_config* config, uint8_t* raw_buffers, int16_t* blocks);
+void pdm_mic_deinit(struct pdm_microphone* mic);
+
+int pdm_mic_start(struct pdm_microphone* mic);
+// Starts instances on state machines of the same PIO and sample rate
+// together, their samples are taken on the same PDM clock edges
+int pdm_mic_start_group(struct pdm_microphone** mics, uint count);
+void pdm_mic_stop(struct pdm_microphone* mic);
+
+void pdm_mic_set_samples_ready_handler(struct pdm_microphone* mic, pdm_mic_samples_ready_handler_t handler);
+void pdm_mic_set_filter_max_volume(struct pdm_microphone* mic, uint8_t max_volume);
+void pdm_mic_set_filter_gain(struct pdm_microphone* mic, uint8_t gain);
+void pdm_mic_set_filter_volume(struct pdm_microphone* mic, uint16_t volume);
+
+// samples counts every channel, samples are interleaved by data pin, then
+// left, right. Decodes up to samples (rounded down to whole samples of every
+// channel) from the queued raw buffers, oldest first, and carries on from
+// there on the next call.
+int pdm_mic_read(struct pdm_microphone* mic, int16_t* buffer, size_t samples);
+
+// Decodes up to sample_buffer_size queued samples as pdm_mic_read() would,
+// into a free block of the pool, and lends it out until released, oldest
+// first. NULL when nothing is queued or every block is lent out.
+const int16_t* pdm_mic_acquire(struct pdm_microphone* mic, size_t* samples);
+void pdm_mic_release(struct pdm_microphone* mic);
+
+uint pdm_mic_get_raw_buffers_available(struct pdm_microphone* mic);
+uint32_t pdm_mic_get_overruns(struct pdm_microphone* mic);
+uint32_t pdm_mic_get_dropped_buffers(struct pdm_microphone* mic);
+
+// all zero without PDM_MICROPHONE_STATS but for the buffer counts
+void pdm_mic_get_stats(struct pdm_microphone* mic, struct pdm_microphone_stats* stats);
+void pdm_mic_reset_stats(struct pdm_microphone* mic);
+
+// single instance API, on a default instance
 int pdm_microphone_init(const struct pdm_microphone_config* config);
+int pdm_microphone_init_static(const struct pdm_microphone_config* config, uint8_t* raw_buffers, int16_t* blocks);
 void pdm_microphone_deinit();
 
 int pdm_microphone_start();
@@ -33,5 +223,14 @@ void pdm_microphone_set_filter_gain(uint8_t gain);
 void pdm_microphone_set_filter_volume(uint16_t volume);
 
 int pdm_microphone_read(int16_t* buffer, size_t samples);
+const int16_t* pdm_microphone_acquire(size_t* samples);
+void pdm_microphone_release();
+
+uint pdm_microphone_get_raw_buffers_available();
+uint32_t pdm_microphone_get_overruns();
+uint32_t pdm_microphone_get_dropped_buffers();
+
+void pdm_microphone_get_stats(struct pdm_microphone_stats* stats);
+void pdm_microphone_reset_stats();
 
 #endif
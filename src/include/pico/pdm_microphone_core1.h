@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _PICO_PDM_MICROPHONE_CORE1_H_
+#define _PICO_PDM_MICROPHONE_CORE1_H_
+
+#include "pico/pdm_microphone.h"
+
+// Decodes on core1: the DMA IRQ on core0 passes filled raw buffers of the
+// added instances to core1 through the multicore FIFO, core1 filters them
+// into blocks of sample_buffer_size samples and core0 takes the blocks in
+// place. Core1 and its FIFO are dedicated to this once started.
+
+// decoded blocks of one instance, allocated by the caller, the fields are
+// private
+struct pdm_mic_core1_output {
+    struct pdm_microphone* mic;
+    int16_t* blocks;
+    uint block_count;
+    uint block_samples;
+    // free running block counts, written by core1 and core0
+    uint32_t produced;
+    uint32_t consumed;
+    // raw buffers left queued as every block was full
+    uint32_t full;
+    struct pdm_mic_core1_output* next;
+};
+
+struct pdm_mic_core1_stats {
+    // since pdm_mic_core1_start(), to divide the busy times by
+    uint32_t elapsed_us;
+    // core0 pushing buffers to the multicore FIFO in the samples ready
+    // handler only, not the rest of the DMA IRQ handler around it
+    uint32_t core0_fifo_push_us;
+    // core1 filtering
+    uint32_t core1_busy_us;
+    uint32_t blocks_decoded;
+};
+
+// Before pdm_mic_core1_start(), after pdm_mic_init(): blocks holds
+// block_count (a power of two) blocks of sample_buffer_size samples. Replaces
+// the samples ready handler of mic.
+int pdm_mic_core1_add(struct pdm_microphone* mic, struct pdm_mic_core1_output* output, int16_t* blocks, uint block_count);
+
+void pdm_mic_core1_start();
+
+// Oldest decoded block, or NULL, to be released once used. samples is
+// sample_buffer_size of the instance.
+const int16_t* pdm_mic_core1_acquire(struct pdm_mic_core1_output* output, size_t* samples);
+void pdm_mic_core1_release(struct pdm_mic_core1_output* output);
+
+void pdm_mic_core1_get_stats(struct pdm_mic_core1_stats* stats);
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include "hardware/adc.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+#include "pdm_microphone.pio.h"
+
+#include "pico/microphone_hal.h"
+
+// handlers added to each DMA IRQ line, it is enabled while there are any
+static uint mic_hal_irq_handlers[MIC_HAL_DMA_IRQ_COUNT];
+
+int mic_hal_dma_claim() {
+    return dma_claim_unused_channel(true);
+}
+
+void mic_hal_dma_unclaim(int channel) {
+    dma_channel_unclaim(channel);
+}
+
+// channel triggers chain_to once done, or nothing when chained to itself
+static void mic_hal_dma_chain_to(uint channel, uint chain_to) {
+    hw_write_masked(
+        &dma_hw->ch[channel].al1_ctrl,
+        chain_to << DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB,
+        DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS
+    );
+}
+
+void mic_hal_dma_capture_init(int channel, int control_channel, const volatile void* src, uint dreq,
+                              uint transfer_size, bool bswap, uint transfer_count, void** write_addr, uint buffer_count) {
+    dma_channel_config dma_channel_cfg = dma_channel_get_default_config(channel);
+
+    enum dma_channel_transfer_size dma_size = (transfer_size == 4) ? DMA_SIZE_32 : (transfer_size == 2) ? DMA_SIZE_16 : DMA_SIZE_8;
+
+    channel_config_set_transfer_data_size(&dma_channel_cfg, dma_size);
+    channel_config_set_bswap(&dma_channel_cfg, bswap);
+    channel_config_set_read_increment(&dma_channel_cfg, false);
+    channel_config_set_write_increment(&dma_channel_cfg, true);
+    channel_config_set_dreq(&dma_channel_cfg, dreq);
+
+    if (control_channel >= 0) {
+        // once a buffer is full the control channel writes the address of
+        // the next one to the data channel, which retriggers it: the FIFO
+        // holds the few clocks this takes
+        channel_config_set_chain_to(&dma_channel_cfg, control_channel);
+
+        dma_channel_config dma_control_channel_cfg = dma_channel_get_default_config(control_channel);
+
+        channel_config_set_transfer_data_size(&dma_control_channel_cfg, DMA_SIZE_32);
+        channel_config_set_read_increment(&dma_control_channel_cfg, true);
+        channel_config_set_write_increment(&dma_control_channel_cfg, false);
+        channel_config_set_ring(&dma_control_channel_cfg, false, __builtin_ctz(buffer_count * sizeof(write_addr[0])));
+
+        dma_channel_configure(
+            control_channel,
+            &dma_control_channel_cfg,
+            &dma_hw->ch[channel].al2_write_addr_trig,
+            &write_addr[1],
+            1,
+            false
+        );
+    }
+
+    dma_channel_configure(
+        channel,
+        &dma_channel_cfg,
+        write_addr[0],
+        src,
+        transfer_count,
+        false
+    );
+}
+
+void mic_hal_dma_capture_start(int channel, int control_channel, void** write_addr, uint transfer_count) {
+    // the first buffer is started below, the control channel loads the next
+    if (control_channel >= 0) {
+        dma_channel_set_read_addr(control_channel, &write_addr[1], false);
+    }
+
+    dma_channel_transfer_to_buffer_now(channel, write_addr[0], transfer_count);
+}
+
+void mic_hal_dma_capture_next(int channel, void* buffer, uint transfer_count) {
+    dma_channel_transfer_to_buffer_now(channel, buffer, transfer_count);
+}
+
+void mic_hal_dma_capture_stop(int channel, int control_channel) {
+    if (control_channel >= 0) {
+        // unchained while aborting, so the control channel cannot restart it
+        mic_hal_dma_chain_to(channel, channel);
+
+        dma_channel_abort(control_channel);
+    }
+
+    dma_channel_abort(channel);
+
+    if (control_channel >= 0) {
+        mic_hal_dma_chain_to(channel, control_channel);
+    }
+}
+
+uint32_t mic_hal_dma_remaining(int channel) {
+    return dma_hw->ch[channel].transfer_count;
+}
+
+void mic_hal_dma_set_irq_enabled(int channel, uint irq, bool enabled) {
+    if (irq == 0) {
+        dma_channel_set_irq0_enabled(channel, enabled);
+    } else {
+        dma_channel_set_irq1_enabled(channel, enabled);
+    }
+}
+
+bool mic_hal_dma_irq_clear(uint irq, int channel) {
+    io_rw_32* ints = (irq == 0) ? &dma_hw->ints0 : &dma_hw->ints1;
+
+    if (!(*ints & (1u << channel))) {
+        return false;
+    }
+
+    *ints = (1u << channel);
+
+    return true;
+}
+
+void mic_hal_irq_add_handler(uint irq, mic_hal_irq_handler_t handler) {
+    irq_add_shared_handler(DMA_IRQ_0 + irq, handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+
+    if (mic_hal_irq_handlers[irq]++ == 0) {
+        irq_set_enabled(DMA_IRQ_0 + irq, true);
+    }
+}
+
+void mic_hal_irq_remove_handler(uint irq, mic_hal_irq_handler_t handler) {
+    if (--mic_hal_irq_handlers[irq] == 0) {
+        irq_set_enabled(DMA_IRQ_0 + irq, false);
+    }
+
+    irq_remove_handler(DMA_IRQ_0 + irq, handler);
+}
+
+uint32_t mic_hal_interrupts_disable() {
+    return save_and_disable_interrupts();
+}
+
+void mic_hal_interrupts_restore(uint32_t status) {
+    restore_interrupts(status);
+}
+
+int mic_hal_pdm_init(PIO pio, uint sm, uint gpio_data, uint data_pins, uint gpio_clk, bool stereo, uint clock_hz, bool push_32) {
+    // the programs take 4 cycles per PDM clock
+    float clk_div = clock_get_hz(clk_sys) / (clock_hz * 4.0);
+
+    if (clk_div < 1) {
+        return -1;
+    }
+
+    // every instance loads its own program, patched for its data pins
+    if (stereo) {
+        uint offset = pdm_microphone_add_program(pio, &pdm_microphone_stereo_data_program, data_pins);
+
+        pdm_microphone_stereo_data_init(pio, sm, offset, clk_div, gpio_data, data_pins, gpio_clk, push_32);
+
+        return offset;
+    }
+
+    uint offset = pdm_microphone_add_program(pio, &pdm_microphone_data_program, data_pins);
+
+    pdm_microphone_data_init(pio, sm, offset, clk_div, gpio_data, data_pins, gpio_clk, push_32);
+
+    return offset;
+}
+
+void mic_hal_pdm_deinit(PIO pio, bool stereo, int offset) {
+    pio_remove_program(pio, stereo ? &pdm_microphone_stereo_data_program : &pdm_microphone_data_program, offset);
+}
+
+void mic_hal_pdm_reset(PIO pio, uint sm, int offset) {
+    pio_sm_set_enabled(pio, sm, false);
+    pio_sm_clear_fifos(pio, sm);
+    pio_sm_restart(pio, sm);
+    pio_sm_exec(pio, sm, pio_encode_jmp(offset));
+}
+
+void mic_hal_pdm_set_enabled(PIO pio, uint sm, bool enabled) {
+    pio_sm_set_enabled(pio, sm, enabled);
+}
+
+void mic_hal_pdm_enable_in_sync(PIO pio, uint32_t sm_mask) {
+    pio_enable_sm_mask_in_sync(pio, sm_mask);
+}
+
+const volatile void* mic_hal_pdm_fifo(PIO pio, uint sm) {
+    return &pio->rxf[sm];
+}
+
+uint mic_hal_pdm_dreq(PIO pio, uint sm) {
+    return pio_get_dreq(pio, sm, false);
+}
+
+uint mic_hal_pdm_fifo_level(PIO pio, uint sm) {
+    return pio_sm_get_rx_fifo_level(pio, sm);
+}
+
+void mic_hal_adc_init(uint gpio, uint sample_rate) {
+    float clk_div = (clock_get_hz(clk_adc) / (1.0 * sample_rate)) - 1;
+
+    adc_gpio_init(gpio);
+
+    adc_init();
+    adc_select_input(gpio - 26);
+    adc_fifo_setup(
+        true,    // Write each completed conversion to the sample FIFO
+        true,    // Enable DMA data request (DREQ)
+        1,       // DREQ (and IRQ) asserted when at least 1 sample present
+        false,   // We won't see the ERR bit because of 8 bit reads; disable.
+        false    // Don't shift each sample to 8 bits when pushing to FIFO
+    );
+
+    adc_set_clkdiv(clk_div);
+}
+
+void mic_hal_adc_run(bool run) {
+    adc_run(run);
+}
+
+const volatile void* mic_hal_adc_fifo() {
+    return &adc_hw->fifo;
+}
+
+uint mic_hal_adc_dreq() {
+    return DREQ_ADC;
+}
+
+uint mic_hal_adc_fifo_level() {
+    return adc_fifo_get_level();
+}
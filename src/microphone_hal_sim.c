@@ -0,0 +1,781 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+// Host simulation of the microphone HAL. Every source (a PDM state machine or
+// the ADC) plays its input as a stream of FIFO entries from the moment it is
+// enabled, entry k being in its FIFO (k + 1) entry times later. A PDM entry
+// is a push of the state machine, the input bits shifted in from the top, and
+// an ADC entry a sample. A thread completes the buffers of the DMA channels
+// reading the sources at those times, one entry per transfer with the byte
+// swap applied, and calls the IRQ handlers the injected latency after a
+// buffer completes. A full FIFO drops new entries, as "push noblock" does.
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pico/microphone_hal.h"
+
+#define SIM_DMA_CHANNELS   12
+#define SIM_PIO_SMS        4
+#define SIM_IRQ_HANDLERS   4
+// joined RX FIFO of a state machine and the ADC FIFO, in entries
+#define SIM_PDM_FIFO_DEPTH 8
+#define SIM_ADC_FIFO_DEPTH 4
+
+struct mic_hal_sim_pio {
+    uint index;
+};
+
+struct mic_hal_sim_pio mic_hal_sim_pio0 = { 0 };
+struct mic_hal_sim_pio mic_hal_sim_pio1 = { 1 };
+
+struct sim_source {
+    bool running;
+    // simulated time it was enabled
+    uint64_t start_ns;
+    double bytes_per_s;
+    // input bytes per FIFO entry, the first one the top byte of a PDM push
+    // and the low byte of an ADC sample
+    uint entry_size;
+    bool shift_left;
+    uint fifo_depth;
+    const uint8_t* data;
+    size_t size;
+    bool loop;
+    // data was loaded from a file
+    bool owned;
+};
+
+struct sim_dma {
+    bool claimed;
+    int control_channel;
+    struct sim_source* src;
+    uint transfer_size;
+    bool bswap;
+    uint transfer_count;
+    void** write_addr;
+    uint buffer_count;
+    uint ring_index;
+    // being filled, or NULL when stopped
+    uint8_t* buffer;
+    // entry of the source stream the buffer starts with
+    uint64_t next_transfer;
+    // entries the full FIFO dropped after the first skip_from of the buffer
+    uint skip_from;
+    uint64_t skip;
+    bool irq_enabled[MIC_HAL_DMA_IRQ_COUNT];
+    bool irq_pending;
+    uint64_t irq_due_ns;
+};
+
+static struct {
+    pthread_once_t once;
+    // held by the thread while it runs the DMA and IRQ handlers, and as
+    // masked interrupts
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool running;
+    bool shutdown;
+    // simulated time is sim_base_ns + (host time - host_base_ns) * speed
+    double speed;
+    uint64_t host_base_ns;
+    uint64_t sim_base_ns;
+    uint32_t latency_min_us;
+    uint32_t latency_max_us;
+    unsigned seed;
+    struct sim_source pdm[2][SIM_PIO_SMS];
+    struct sim_source adc;
+    struct sim_dma dma[SIM_DMA_CHANNELS];
+    mic_hal_irq_handler_t handlers[MIC_HAL_DMA_IRQ_COUNT][SIM_IRQ_HANDLERS];
+    struct mic_hal_sim_stats stats;
+} sim = {
+    .once = PTHREAD_ONCE_INIT,
+    .speed = 1.0,
+};
+
+static uint64_t sim_host_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// simulated time of the event the thread handles, which the handlers see as
+// the current time whatever the host took to wake the thread up
+static __thread uint64_t sim_event_ns;
+
+static uint64_t sim_now_ns() {
+    if (sim_event_ns) {
+        return sim_event_ns;
+    }
+
+    return sim.sim_base_ns + (uint64_t)((sim_host_ns() - sim.host_base_ns) * sim.speed);
+}
+
+static void* sim_thread(void* arg);
+
+static void sim_init() {
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_settype(&mutex_attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&sim.lock, &mutex_attr);
+
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sim.cond, &cond_attr);
+
+    sim.host_base_ns = sim_host_ns();
+
+    if (pthread_create(&sim.thread, NULL, sim_thread, NULL) == 0) {
+        sim.running = true;
+    }
+}
+
+static void sim_lock() {
+    pthread_once(&sim.once, sim_init);
+    pthread_mutex_lock(&sim.lock);
+}
+
+// wakes the thread up to look at the changed state
+static void sim_unlock() {
+    pthread_cond_signal(&sim.cond);
+    pthread_mutex_unlock(&sim.lock);
+}
+
+// entries of the source stream pushed by now
+static uint64_t sim_source_entries(const struct sim_source* src, uint64_t now_ns) {
+    if (!src->running || now_ns < src->start_ns) {
+        return 0;
+    }
+
+    return (uint64_t)((now_ns - src->start_ns) * 1e-9 * src->bytes_per_s / src->entry_size);
+}
+
+static uint64_t sim_source_time_ns(const struct sim_source* src, uint64_t entries) {
+    return src->start_ns + (uint64_t)(entries * src->entry_size * 1e9 / src->bytes_per_s);
+}
+
+static void sim_source_read(const struct sim_source* src, uint64_t offset, uint8_t* out, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        uint64_t pos = offset + i;
+
+        if (src->data == NULL || src->size == 0 || (!src->loop && pos >= src->size)) {
+            out[i] = 0;
+        } else {
+            out[i] = src->data[pos % src->size];
+        }
+    }
+}
+
+// simulated time the buffer of a channel is full, or UINT64_MAX
+static uint64_t sim_dma_complete_ns(const struct sim_dma* dma) {
+    if (dma->buffer == NULL || dma->src == NULL || !dma->src->running || dma->src->bytes_per_s <= 0) {
+        return UINT64_MAX;
+    }
+
+    return sim_source_time_ns(dma->src, dma->next_transfer + dma->skip + dma->transfer_count);
+}
+
+static uint64_t sim_irq_latency_ns() {
+    uint32_t us = sim.latency_min_us;
+
+    if (sim.latency_max_us > sim.latency_min_us) {
+        us += rand_r(&sim.seed) % (sim.latency_max_us - sim.latency_min_us + 1);
+    }
+
+    return us * 1000ull;
+}
+
+// FIFO entry as the DMA reads it, e.g. the low byte of a 32-bit push
+static uint32_t sim_source_entry(const struct sim_source* src, uint64_t entry) {
+    uint8_t bytes[4];
+    uint32_t value = 0;
+
+    sim_source_read(src, entry * src->entry_size, bytes, src->entry_size);
+
+    for (uint i = 0; i < src->entry_size; i++) {
+        uint shift = src->shift_left ? 8 * (src->entry_size - 1 - i) : 8 * i;
+
+        value |= (uint32_t)bytes[i] << shift;
+    }
+
+    return value;
+}
+
+static void sim_dma_complete(struct sim_dma* dma, uint64_t now_ns) {
+    uint8_t* out = dma->buffer;
+
+    for (uint t = 0; t < dma->transfer_count; t++) {
+        uint64_t entry = dma->next_transfer + t + ((t >= dma->skip_from) ? dma->skip : 0);
+        uint32_t value = sim_source_entry(dma->src, entry);
+
+        // little endian, or reversed by the byte swap
+        for (uint b = 0; b < dma->transfer_size; b++) {
+            uint shift = dma->bswap ? 8 * (dma->transfer_size - 1 - b) : 8 * b;
+
+            *out++ = value >> shift;
+        }
+    }
+
+    sim.stats.dma_buffers++;
+
+    if (dma->irq_pending) {
+        sim.stats.irqs_merged++;
+    } else {
+        dma->irq_pending = true;
+        dma->irq_due_ns = now_ns + sim_irq_latency_ns();
+    }
+
+    dma->next_transfer += dma->transfer_count + dma->skip;
+    dma->skip = 0;
+
+    if (dma->control_channel >= 0) {
+        dma->ring_index = (dma->ring_index + 1) & (dma->buffer_count - 1);
+        dma->buffer = dma->write_addr[dma->ring_index];
+    } else {
+        dma->buffer = NULL;
+    }
+}
+
+static int sim_dma_irq(const struct sim_dma* dma) {
+    for (uint irq = 0; irq < MIC_HAL_DMA_IRQ_COUNT; irq++) {
+        if (dma->irq_enabled[irq]) {
+            return irq;
+        }
+    }
+
+    return -1;
+}
+
+static void sim_raise_irq(struct sim_dma* dma) {
+    int irq = sim_dma_irq(dma);
+
+    sim.stats.irqs++;
+
+    for (uint i = 0; i < SIM_IRQ_HANDLERS; i++) {
+        if (sim.handlers[irq][i]) {
+            sim.handlers[irq][i]();
+        }
+    }
+
+    // nobody acknowledged it, which would otherwise raise it forever
+    dma->irq_pending = false;
+}
+
+static void* sim_thread(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&sim.lock);
+
+    while (!sim.shutdown) {
+        struct sim_dma* next = NULL;
+        uint64_t next_ns = UINT64_MAX;
+        bool next_is_irq = false;
+
+        for (uint i = 0; i < SIM_DMA_CHANNELS; i++) {
+            struct sim_dma* dma = &sim.dma[i];
+            uint64_t complete_ns = sim_dma_complete_ns(dma);
+
+            if (complete_ns < next_ns) {
+                next = dma;
+                next_ns = complete_ns;
+                next_is_irq = false;
+            }
+
+            if (dma->irq_pending && sim_dma_irq(dma) >= 0 && dma->irq_due_ns < next_ns) {
+                next = dma;
+                next_ns = dma->irq_due_ns;
+                next_is_irq = true;
+            }
+        }
+
+        if (next == NULL) {
+            pthread_cond_wait(&sim.cond, &sim.lock);
+
+            continue;
+        }
+
+        uint64_t now_ns = sim_now_ns();
+
+        if (next_ns > now_ns) {
+            uint64_t wake_ns = sim.host_base_ns + (uint64_t)((next_ns - sim.sim_base_ns) / sim.speed);
+            struct timespec wake = { wake_ns / 1000000000ull, wake_ns % 1000000000ull };
+
+            // or earlier when the state changes
+            pthread_cond_timedwait(&sim.cond, &sim.lock, &wake);
+
+            continue;
+        }
+
+        sim_event_ns = next_ns;
+
+        if (next_is_irq) {
+            sim_raise_irq(next);
+        } else {
+            sim_dma_complete(next, next_ns);
+        }
+
+        sim_event_ns = 0;
+    }
+
+    pthread_mutex_unlock(&sim.lock);
+
+    return NULL;
+}
+
+int mic_hal_dma_claim() {
+    int channel = -1;
+
+    sim_lock();
+
+    for (int i = 0; i < SIM_DMA_CHANNELS; i++) {
+        if (!sim.dma[i].claimed) {
+            memset(&sim.dma[i], 0x00, sizeof(sim.dma[i]));
+            sim.dma[i].claimed = true;
+
+            channel = i;
+            break;
+        }
+    }
+
+    sim_unlock();
+
+    return channel;
+}
+
+void mic_hal_dma_unclaim(int channel) {
+    sim_lock();
+
+    sim.dma[channel].claimed = false;
+    sim.dma[channel].buffer = NULL;
+
+    sim_unlock();
+}
+
+void mic_hal_dma_capture_init(int channel, int control_channel, const volatile void* src, uint dreq,
+                              uint transfer_size, bool bswap, uint transfer_count, void** write_addr, uint buffer_count) {
+    struct sim_dma* dma = &sim.dma[channel];
+
+    // transfers are paced by the source itself
+    (void)dreq;
+
+    sim_lock();
+
+    dma->control_channel = control_channel;
+    dma->src = (struct sim_source*)src;
+    dma->transfer_size = transfer_size;
+    dma->bswap = bswap;
+    dma->transfer_count = transfer_count;
+    dma->write_addr = write_addr;
+    dma->buffer_count = buffer_count;
+    dma->buffer = NULL;
+
+    sim_unlock();
+}
+
+void mic_hal_dma_capture_start(int channel, int control_channel, void** write_addr, uint transfer_count) {
+    struct sim_dma* dma = &sim.dma[channel];
+
+    // the channel follows write_addr itself, set by mic_hal_dma_capture_init()
+    (void)control_channel;
+
+    sim_lock();
+
+    dma->write_addr = write_addr;
+    dma->ring_index = 0;
+    dma->buffer = write_addr[0];
+    dma->transfer_count = transfer_count;
+    dma->next_transfer = sim_source_entries(dma->src, sim_now_ns());
+    dma->skip = 0;
+
+    sim_unlock();
+}
+
+void mic_hal_dma_capture_next(int channel, void* buffer, uint transfer_count) {
+    struct sim_dma* dma = &sim.dma[channel];
+
+    sim_lock();
+
+    // the FIFO kept the entries pushed first since the last buffer completed
+    // and dropped the ones after, the buffer continues with the current one
+    uint64_t entries = sim_source_entries(dma->src, sim_now_ns());
+
+    dma->skip_from = dma->src->fifo_depth;
+    dma->skip = 0;
+
+    if (entries > dma->next_transfer + dma->src->fifo_depth) {
+        dma->skip = entries - (dma->next_transfer + dma->src->fifo_depth);
+
+        sim.stats.fifo_overflows += dma->skip;
+    }
+
+    dma->buffer = buffer;
+    dma->transfer_count = transfer_count;
+
+    sim_unlock();
+}
+
+void mic_hal_dma_capture_stop(int channel, int control_channel) {
+    (void)control_channel;
+
+    sim_lock();
+
+    sim.dma[channel].buffer = NULL;
+    sim.dma[channel].irq_pending = false;
+
+    sim_unlock();
+}
+
+uint32_t mic_hal_dma_remaining(int channel) {
+    struct sim_dma* dma = &sim.dma[channel];
+    uint32_t remaining = 0;
+
+    sim_lock();
+
+    if (dma->buffer != NULL) {
+        // the dropped entries were never read
+        uint64_t entries = sim_source_entries(dma->src, sim_now_ns()) - dma->skip;
+        uint64_t done = (entries > dma->next_transfer) ? (entries - dma->next_transfer) : 0;
+
+        remaining = (done < dma->transfer_count) ? (dma->transfer_count - done) : 0;
+    }
+
+    sim_unlock();
+
+    return remaining;
+}
+
+void mic_hal_dma_set_irq_enabled(int channel, uint irq, bool enabled) {
+    sim_lock();
+
+    sim.dma[channel].irq_enabled[irq] = enabled;
+
+    sim_unlock();
+}
+
+bool mic_hal_dma_irq_clear(uint irq, int channel) {
+    struct sim_dma* dma = &sim.dma[channel];
+    bool raised;
+
+    sim_lock();
+
+    raised = dma->irq_pending && dma->irq_enabled[irq];
+
+    if (raised) {
+        dma->irq_pending = false;
+    }
+
+    sim_unlock();
+
+    return raised;
+}
+
+void mic_hal_irq_add_handler(uint irq, mic_hal_irq_handler_t handler) {
+    sim_lock();
+
+    for (uint i = 0; i < SIM_IRQ_HANDLERS; i++) {
+        if (sim.handlers[irq][i] == NULL) {
+            sim.handlers[irq][i] = handler;
+            break;
+        }
+    }
+
+    sim_unlock();
+}
+
+void mic_hal_irq_remove_handler(uint irq, mic_hal_irq_handler_t handler) {
+    sim_lock();
+
+    for (uint i = 0; i < SIM_IRQ_HANDLERS; i++) {
+        if (sim.handlers[irq][i] == handler) {
+            sim.handlers[irq][i] = NULL;
+            break;
+        }
+    }
+
+    sim_unlock();
+}
+
+uint32_t mic_hal_interrupts_disable() {
+    sim_lock();
+
+    return 0;
+}
+
+void mic_hal_interrupts_restore(uint32_t status) {
+    (void)status;
+
+    sim_unlock();
+}
+
+int mic_hal_pdm_init(PIO pio, uint sm, uint gpio_data, uint data_pins, uint gpio_clk, bool stereo, uint clock_hz, bool push_32) {
+    struct sim_source* src = &sim.pdm[pio->index][sm];
+    uint clock_bits = data_pins * (stereo ? 2 : 1);
+
+    // no pins in the simulation
+    (void)gpio_data;
+    (void)gpio_clk;
+
+    sim_lock();
+
+    src->running = false;
+    src->bytes_per_s = clock_hz * (double)clock_bits / 8;
+    src->entry_size = (push_32 || clock_bits >= 4) ? 4 : clock_bits;
+    src->shift_left = true;
+    src->fifo_depth = SIM_PDM_FIFO_DEPTH;
+
+    sim_unlock();
+
+    return 0;
+}
+
+void mic_hal_pdm_deinit(PIO pio, bool stereo, int offset) {
+    // no program memory in the simulation
+    (void)pio;
+    (void)stereo;
+    (void)offset;
+}
+
+void mic_hal_pdm_reset(PIO pio, uint sm, int offset) {
+    (void)offset;
+
+    sim_lock();
+
+    sim.pdm[pio->index][sm].running = false;
+
+    sim_unlock();
+}
+
+void mic_hal_pdm_set_enabled(PIO pio, uint sm, bool enabled) {
+    sim_lock();
+
+    sim.pdm[pio->index][sm].running = enabled;
+    sim.pdm[pio->index][sm].start_ns = sim_now_ns();
+
+    sim_unlock();
+}
+
+void mic_hal_pdm_enable_in_sync(PIO pio, uint32_t sm_mask) {
+    sim_lock();
+
+    uint64_t now_ns = sim_now_ns();
+
+    for (uint sm = 0; sm < SIM_PIO_SMS; sm++) {
+        if (sm_mask & (1u << sm)) {
+            sim.pdm[pio->index][sm].running = true;
+            sim.pdm[pio->index][sm].start_ns = now_ns;
+        }
+    }
+
+    sim_unlock();
+}
+
+const volatile void* mic_hal_pdm_fifo(PIO pio, uint sm) {
+    return &sim.pdm[pio->index][sm];
+}
+
+uint mic_hal_pdm_dreq(PIO pio, uint sm) {
+    (void)pio;
+    (void)sm;
+
+    return 0;
+}
+
+// what a stopped channel reading it left in the FIFO
+static uint sim_fifo_level(const struct sim_source* src) {
+    uint level = 0;
+
+    sim_lock();
+
+    for (uint i = 0; i < SIM_DMA_CHANNELS; i++) {
+        const struct sim_dma* dma = &sim.dma[i];
+
+        if (dma->claimed && dma->src == src && dma->buffer == NULL) {
+            uint64_t waiting = sim_source_entries(src, sim_now_ns()) - dma->next_transfer;
+
+            level = (waiting < src->fifo_depth) ? waiting : src->fifo_depth;
+        }
+    }
+
+    sim_unlock();
+
+    return level;
+}
+
+uint mic_hal_pdm_fifo_level(PIO pio, uint sm) {
+    return sim_fifo_level(&sim.pdm[pio->index][sm]);
+}
+
+void mic_hal_adc_init(uint gpio, uint sample_rate) {
+    (void)gpio;
+
+    sim_lock();
+
+    sim.adc.running = false;
+    sim.adc.bytes_per_s = sample_rate * 2.0;
+    sim.adc.entry_size = 2;
+    sim.adc.shift_left = false;
+    sim.adc.fifo_depth = SIM_ADC_FIFO_DEPTH;
+
+    sim_unlock();
+}
+
+void mic_hal_adc_run(bool run) {
+    sim_lock();
+
+    sim.adc.running = run;
+    sim.adc.start_ns = sim_now_ns();
+
+    sim_unlock();
+}
+
+const volatile void* mic_hal_adc_fifo() {
+    return &sim.adc;
+}
+
+uint mic_hal_adc_dreq() {
+    return 0;
+}
+
+uint mic_hal_adc_fifo_level() {
+    return sim_fifo_level(&sim.adc);
+}
+
+void mic_hal_cycles_init() {
+}
+
+uint32_t mic_hal_cycles() {
+    return (uint32_t)sim_host_ns();
+}
+
+uint32_t mic_hal_cycles_since(uint32_t start) {
+    return mic_hal_cycles() - start;
+}
+
+static void sim_source_set_input(struct sim_source* src, const void* data, size_t size, bool loop, bool owned) {
+    sim_lock();
+
+    if (src->owned) {
+        free((void*)src->data);
+    }
+
+    src->data = data;
+    src->size = size;
+    src->loop = loop;
+    src->owned = owned;
+
+    sim_unlock();
+}
+
+void mic_hal_sim_set_pdm_input(PIO pio, uint sm, const void* data, size_t size, bool loop) {
+    sim_source_set_input(&sim.pdm[pio->index][sm], data, size, loop, false);
+}
+
+void mic_hal_sim_set_adc_input(const void* data, size_t size, bool loop) {
+    sim_source_set_input(&sim.adc, data, size, loop, false);
+}
+
+static int sim_source_load(struct sim_source* src, const char* path, bool loop) {
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+
+    long size = ftell(file);
+    uint8_t* data = (size > 0) ? malloc(size) : NULL;
+
+    fseek(file, 0, SEEK_SET);
+
+    if (data == NULL || fread(data, 1, size, file) != (size_t)size) {
+        free(data);
+        fclose(file);
+
+        return -1;
+    }
+
+    fclose(file);
+
+    sim_source_set_input(src, data, size, loop, true);
+
+    return 0;
+}
+
+int mic_hal_sim_load_pdm_input(PIO pio, uint sm, const char* path, bool loop) {
+    return sim_source_load(&sim.pdm[pio->index][sm], path, loop);
+}
+
+int mic_hal_sim_load_adc_input(const char* path, bool loop) {
+    return sim_source_load(&sim.adc, path, loop);
+}
+
+void mic_hal_sim_set_speed(double speed) {
+    sim_lock();
+
+    sim.sim_base_ns = sim_now_ns();
+    sim.host_base_ns = sim_host_ns();
+    sim.speed = speed;
+
+    sim_unlock();
+}
+
+void mic_hal_sim_set_irq_latency(uint32_t min_us, uint32_t max_us, unsigned seed) {
+    sim_lock();
+
+    sim.latency_min_us = min_us;
+    sim.latency_max_us = max_us;
+    sim.seed = seed;
+
+    sim_unlock();
+}
+
+uint64_t mic_hal_sim_time_us() {
+    pthread_once(&sim.once, sim_init);
+
+    return sim_now_ns() / 1000;
+}
+
+void mic_hal_sim_sleep_us(uint64_t us) {
+    uint64_t host_ns = (uint64_t)(us * 1000 / sim.speed);
+    struct timespec ts = { host_ns / 1000000000ull, host_ns % 1000000000ull };
+
+    nanosleep(&ts, NULL);
+}
+
+void mic_hal_sim_get_stats(struct mic_hal_sim_stats* stats) {
+    sim_lock();
+
+    *stats = sim.stats;
+
+    sim_unlock();
+}
+
+void mic_hal_sim_shutdown() {
+    sim_lock();
+
+    bool running = sim.running;
+
+    sim.shutdown = true;
+    sim.running = false;
+
+    sim_unlock();
+
+    if (running) {
+        pthread_join(sim.thread, NULL);
+    }
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <string.h>
+
+#include "pico/pcm_ring.h"
+
+#if PICO_ON_DEVICE
+#include "pico.h"
+#else
+// host builds, e.g. host/pcm_ring_stress.c
+#include <sched.h>
+
+#define tight_loop_contents() sched_yield()
+#endif
+
+int pcm_ring_init(struct pcm_ring* ring, int16_t* buffer, size_t size) {
+    if (size == 0 || (size & (size - 1)) || size > 0x80000000u) {
+        return -1;
+    }
+
+    ring->buffer = buffer;
+    ring->size = size;
+
+    pcm_ring_reset(ring);
+
+    return 0;
+}
+
+// only while neither side is using the ring
+void pcm_ring_reset(struct pcm_ring* ring) {
+    __atomic_store_n(&ring->head, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->tail, 0, __ATOMIC_RELEASE);
+}
+
+size_t pcm_ring_available(const struct pcm_ring* ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+size_t pcm_ring_free(const struct pcm_ring* ring) {
+    return ring->size - pcm_ring_available(ring);
+}
+
+size_t pcm_ring_write(struct pcm_ring* ring, const int16_t* samples, size_t count) {
+    uint32_t head = ring->head;
+    // the consumer is done with everything before tail
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    size_t space = ring->size - (head - tail);
+
+    if (count > space) {
+        count = space;
+    }
+
+    uint32_t offset = head & (ring->size - 1);
+    size_t first = ring->size - offset;
+
+    if (first > count) {
+        first = count;
+    }
+
+    memcpy(ring->buffer + offset, samples, first * sizeof(samples[0]));
+    memcpy(ring->buffer, samples + first, (count - first) * sizeof(samples[0]));
+
+    // samples are visible before the consumer sees the new head
+    __atomic_store_n(&ring->head, head + count, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+size_t pcm_ring_read(struct pcm_ring* ring, int16_t* samples, size_t count) {
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (count > head - tail) {
+        count = head - tail;
+    }
+
+    uint32_t offset = tail & (ring->size - 1);
+    size_t first = ring->size - offset;
+
+    if (first > count) {
+        first = count;
+    }
+
+    memcpy(samples, ring->buffer + offset, first * sizeof(samples[0]));
+    memcpy(samples + first, ring->buffer, (count - first) * sizeof(samples[0]));
+
+    // copied out before the producer may overwrite them
+    __atomic_store_n(&ring->tail, tail + count, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+bool pcm_ring_read_exact(struct pcm_ring* ring, int16_t* samples, size_t count) {
+    if (pcm_ring_available(ring) < count) {
+        return false;
+    }
+
+    pcm_ring_read(ring, samples, count);
+
+    return true;
+}
+
+size_t pcm_ring_read_blocking(struct pcm_ring* ring, int16_t* samples, size_t count) {
+    size_t read = 0;
+
+    // in parts, count may be more than the ring holds
+    while (read < count) {
+        size_t got = pcm_ring_read(ring, samples + read, count - read);
+
+        if (got == 0) {
+            tight_loop_contents();
+        }
+
+        read += got;
+    }
+
+    return read;
+}
+
+int16_t* pcm_ring_write_acquire(struct pcm_ring* ring, size_t* count) {
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t offset = head & (ring->size - 1);
+    size_t space = ring->size - (head - tail);
+
+    *count = (ring->size - offset < space) ? (ring->size - offset) : space;
+
+    return ring->buffer + offset;
+}
+
+void pcm_ring_write_commit(struct pcm_ring* ring, size_t count) {
+    // written before the consumer sees the new head
+    __atomic_store_n(&ring->head, ring->head + count, __ATOMIC_RELEASE);
+}
+
+const int16_t* pcm_ring_read_acquire(struct pcm_ring* ring, size_t* count) {
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t offset = tail & (ring->size - 1);
+    size_t queued = head - tail;
+
+    *count = (ring->size - offset < queued) ? (ring->size - offset) : queued;
+
+    return ring->buffer + offset;
+}
+
+void pcm_ring_read_release(struct pcm_ring* ring, size_t count) {
+    // used before the producer may overwrite them
+    __atomic_store_n(&ring->tail, ring->tail + count, __ATOMIC_RELEASE);
+}
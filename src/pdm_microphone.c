@@ -8,244 +8,731 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "hardware/clocks.h"
-#include "hardware/dma.h"
-#include "hardware/irq.h"
-
 #include "OpenPDM2PCM/OpenPDMFilter.h"
 
-#include "pdm_microphone.pio.h"
+#include "pdm_microphone_decode.h"
 
 #include "pico/pdm_microphone.h"
 
-#define PDM_DECIMATION       64
-#define PDM_RAW_BUFFER_COUNT 2
+#ifndef PDM_HALFBAND_STAGES
+#define PDM_HALFBAND_STAGES  0
+#endif
+
+// started instances, walked by the DMA IRQ handlers
+static struct pdm_microphone* pdm_active_mics;
 
-static struct {
-    struct pdm_microphone_config config;
-    int dma_channel;
-    uint8_t* raw_buffer[PDM_RAW_BUFFER_COUNT];
-    volatile int raw_buffer_write_index;
-    volatile int raw_buffer_read_index;
-    uint raw_buffer_size;
-    uint dma_irq;
-    TPDMFilter_InitStruct filter;
-    uint16_t filter_volume;
-    pdm_samples_ready_handler_t samples_ready_handler;
-} pdm_mic;
+// default instance of the single instance API
+static struct pdm_microphone pdm_mic;
+static pdm_samples_ready_handler_t pdm_mic_default_handler;
 
-static void pdm_dma_handler();
+static void pdm_dma_irq0_handler();
+static void pdm_dma_irq1_handler();
 
-int pdm_microphone_init(const struct pdm_microphone_config* config) {
-    memset(&pdm_mic, 0x00, sizeof(pdm_mic));
-    memcpy(&pdm_mic.config, config, sizeof(pdm_mic.config));
+int pdm_mic_init(struct pdm_microphone* mic, const struct pdm_microphone_config* config) {
+    return pdm_mic_init_static(mic, config, NULL, NULL);
+}
+
+int pdm_mic_init_static(struct pdm_microphone* mic, const struct pdm_microphone_config* config, uint8_t* raw_buffers, int16_t* blocks) {
+    memset(mic, 0x00, sizeof(*mic));
+    memcpy(&mic->config, config, sizeof(mic->config));
+
+    mic->dma_channel = -1;
+    mic->dma_control_channel = -1;
+    mic->pio_sm_offset = -1;
+
+    uint data_pins = config->data_pins ? config->data_pins : 1;
+    uint edges = config->channels ? config->channels : 1;
+
+    mic->channels = data_pins * edges;
+
+    // the state machine pushes 8 clocks of every channel in 1 or 2 DMA words
+    if (edges > 2 || (mic->channels & (mic->channels - 1)) || mic->channels > PDM_MICROPHONE_MAX_CHANNELS) {
+        return -1;
+    }
+
+    // interleaved by pin, then left and right: the transposed bytes are in
+    // state machine bit order, pin n in bit n and the low clock phase (left)
+    // data_pins bits above the high one
+    for (uint i = 0; i < data_pins; i++) {
+        if (edges == 2) {
+            mic->channel_offset[2 * i] = data_pins + i;
+            mic->channel_offset[2 * i + 1] = i;
+        } else {
+            mic->channel_offset[i] = i;
+        }
+    }
+
+    if (config->sample_buffer_size % mic->channels) {
+        return -1;
+    }
+
+    uint frame_samples = config->frame_samples;
+
+    if (frame_samples == 0) {
+        frame_samples = config->sample_rate / 1000;
+    }
+
+    // the filter counts the samples it writes in 16 bits
+    if (frame_samples == 0 || frame_samples * mic->channels > UINT16_MAX) {
+        return -1;
+    }
 
-    if (config->sample_buffer_size % (config->sample_rate / 1000)) {
+    mic->raw_buffer_count = config->raw_buffer_count ? config->raw_buffer_count : 2;
+
+    // the control channel reads the buffer addresses in ring mode
+    if (mic->raw_buffer_count < 2 || mic->raw_buffer_count > PDM_MICROPHONE_RAW_BUFFER_COUNT_MAX ||
+        (PDM_MICROPHONE_CHAINED_DMA && (mic->raw_buffer_count & (mic->raw_buffer_count - 1)))) {
+        return -1;
+    }
+
+    // the transposition reads the raw buffers in words
+    if ((uintptr_t)raw_buffers & 3) {
         return -1;
     }
 
-    pdm_mic.raw_buffer_size = config->sample_buffer_size * (PDM_DECIMATION / 8);
+    // the control channel wraps around the address list at its size, which
+    // a malloc()ed or embedded instance may not be aligned to
+    if (PDM_MICROPHONE_CHAINED_DMA && ((uintptr_t)mic->dma_write_addr & (mic->raw_buffer_count * sizeof(void*) - 1))) {
+        return -1;
+    }
 
-    for (int i = 0; i < PDM_RAW_BUFFER_COUNT; i++) {
-        pdm_mic.raw_buffer[i] = malloc(pdm_mic.raw_buffer_size);
-        if (pdm_mic.raw_buffer[i] == NULL) {
-            pdm_microphone_deinit();
+    // every channel takes PDM_DECIMATION bits per sample
+    mic->raw_buffer_size = config->sample_buffer_size * (PDM_DECIMATION / 8);
 
-            return -1;   
+    // in whole DMA words, see sample_buffer_size
+    if (PDM_MICROPHONE_PUSH_32 && (mic->raw_buffer_size % 4)) {
+        return -1;
+    }
+
+    if (raw_buffers == NULL) {
+        raw_buffers = malloc(mic->raw_buffer_count * mic->raw_buffer_size);
+        if (raw_buffers == NULL) {
+            return -1;
+        }
+
+        mic->raw_buffers_allocated = true;
+    }
+
+    for (uint i = 0; i < mic->raw_buffer_count; i++) {
+        mic->raw_buffer[i] = raw_buffers + i * mic->raw_buffer_size;
+        mic->dma_write_addr[i] = mic->raw_buffer[i];
+    }
+
+    if (config->block_count) {
+        if (blocks == NULL) {
+            blocks = malloc(config->block_count * config->sample_buffer_size * sizeof(blocks[0]));
+            if (blocks == NULL) {
+                pdm_mic_deinit(mic);
+
+                return -1;
+            }
+
+            mic->blocks_allocated = true;
         }
+
+        mic->blocks = blocks;
     }
 
-    pdm_mic.dma_channel = dma_claim_unused_channel(true);
-    if (pdm_mic.dma_channel < 0) {
-        pdm_microphone_deinit();
+    mic->dma_channel = mic_hal_dma_claim();
+    if (mic->dma_channel < 0) {
+        pdm_mic_deinit(mic);
 
         return -1;
     }
 
-    uint pio_sm_offset = pio_add_program(config->pio, &pdm_microphone_data_program);
+#if PDM_MICROPHONE_CHAINED_DMA
+    mic->dma_control_channel = mic_hal_dma_claim();
+    if (mic->dma_control_channel < 0) {
+        pdm_mic_deinit(mic);
 
-    float clk_div = clock_get_hz(clk_sys) / (config->sample_rate * PDM_DECIMATION * 4.0);
+        return -1;
+    }
+#endif
 
-    pdm_microphone_data_init(
+    mic->pio_sm_offset = mic_hal_pdm_init(
         config->pio,
         config->pio_sm,
-        pio_sm_offset,
-        clk_div,
         config->gpio_data,
-        config->gpio_clk
+        data_pins,
+        config->gpio_clk,
+        edges == 2,
+        config->sample_rate * PDM_DECIMATION,
+        PDM_MICROPHONE_PUSH_32
     );
+    if (mic->pio_sm_offset < 0) {
+        pdm_mic_deinit(mic);
 
-    dma_channel_config dma_channel_cfg = dma_channel_get_default_config(pdm_mic.dma_channel);
-
-    channel_config_set_transfer_data_size(&dma_channel_cfg, DMA_SIZE_8);
-    channel_config_set_read_increment(&dma_channel_cfg, false);
-    channel_config_set_write_increment(&dma_channel_cfg, true);
-    channel_config_set_dreq(&dma_channel_cfg, pio_get_dreq(config->pio, config->pio_sm, false));
+        return -1;
+    }
 
-    pdm_mic.dma_irq = DMA_IRQ_0;
+    // the state machine pushes 8 bits of every channel, at most 32 at a time,
+    // or 32 with PDM_MICROPHONE_PUSH_32. With 1 or 2 channels a word holds
+    // several pushes, byte swapped into clock order.
+#if PDM_MICROPHONE_PUSH_32
+    uint dma_transfer_size = 4;
+#else
+    uint dma_transfer_size = (mic->channels >= 4) ? 4 : mic->channels;
+#endif
 
-    dma_channel_configure(
-        pdm_mic.dma_channel,
-        &dma_channel_cfg,
-        pdm_mic.raw_buffer[0],
-        &config->pio->rxf[config->pio_sm],
-        pdm_mic.raw_buffer_size,
-        false
+    mic->dma_transfer_count = mic->raw_buffer_size / dma_transfer_size;
+    mic->dma_irq = 0;
+
+    mic_hal_dma_capture_init(
+        mic->dma_channel,
+        mic->dma_control_channel,
+        mic_hal_pdm_fifo(config->pio, config->pio_sm),
+        mic_hal_pdm_dreq(config->pio, config->pio_sm),
+        dma_transfer_size,
+        mic->channels <= 2,
+        mic->dma_transfer_count,
+        mic->dma_write_addr,
+        mic->raw_buffer_count
     );
 
-    pdm_mic.filter.Fs = config->sample_rate;
-    pdm_mic.filter.LP_HZ = config->sample_rate / 2;
-    pdm_mic.filter.HP_HZ = 10;
-    pdm_mic.filter.In_MicChannels = 1;
-    pdm_mic.filter.Out_MicChannels = 1;
-    pdm_mic.filter.Decimation = PDM_DECIMATION;
-    pdm_mic.filter.MaxVolume = 64;
-    pdm_mic.filter.Gain = 16;
+    // one filter state per channel, all sharing the same table
+    for (uint i = 0; i < mic->channels; i++) {
+        mic->filter[i].Fs = config->sample_rate;
+        mic->filter[i].FrameSamples = frame_samples;
+        mic->filter[i].LP_HZ = config->sample_rate / 2;
+        mic->filter[i].HP_HZ = 10;
+        mic->filter[i].In_MicChannels = mic->channels;
+        mic->filter[i].Out_MicChannels = mic->channels;
+        mic->filter[i].Decimation = PDM_DECIMATION;
+        mic->filter[i].MaxVolume = 64;
+        mic->filter[i].Gain = 16;
+#ifdef USE_HALFBAND
+        mic->filter[i].HalfBandStages = PDM_HALFBAND_STAGES;
+#endif
+    }
+
+    mic->filter_volume = mic->filter[0].MaxVolume;
 
-    pdm_mic.filter_volume = pdm_mic.filter.MaxVolume;
+    return 0;
 }
 
-void pdm_microphone_deinit() {
-    for (int i = 0; i < PDM_RAW_BUFFER_COUNT; i++) {
-        if (pdm_mic.raw_buffer[i]) {
-            free(pdm_mic.raw_buffer[i]);
+void pdm_mic_deinit(struct pdm_microphone* mic) {
+    if (mic->raw_buffers_allocated) {
+        free(mic->raw_buffer[0]);
+
+        mic->raw_buffers_allocated = false;
+    }
+
+    for (int i = 0; i < PDM_MICROPHONE_RAW_BUFFER_COUNT_MAX; i++) {
+        mic->raw_buffer[i] = NULL;
+    }
+
+    if (mic->blocks_allocated) {
+        free(mic->blocks);
+
+        mic->blocks_allocated = false;
+    }
+
+    mic->blocks = NULL;
+
+    if (mic->dma_channel > -1) {
+        mic_hal_dma_unclaim(mic->dma_channel);
 
-            pdm_mic.raw_buffer[i] = NULL;
+        mic->dma_channel = -1;
+    }
+
+    if (mic->dma_control_channel > -1) {
+        mic_hal_dma_unclaim(mic->dma_control_channel);
+
+        mic->dma_control_channel = -1;
+    }
+
+    if (mic->pio_sm_offset > -1) {
+        mic_hal_pdm_deinit(mic->config.pio, mic->config.channels == 2, mic->pio_sm_offset);
+
+        mic->pio_sm_offset = -1;
+    }
+}
+
+// adds mic to the started instances, installing the handler of its IRQ for
+// the first one
+static void pdm_mic_activate(struct pdm_microphone* mic) {
+    bool irq_in_use = false;
+
+    uint32_t status = mic_hal_interrupts_disable();
+
+    for (struct pdm_microphone* m = pdm_active_mics; m != NULL; m = m->next) {
+        if (m == mic) {
+            // restarted
+            mic_hal_interrupts_restore(status);
+
+            return;
+        }
+
+        if (m->dma_irq == mic->dma_irq) {
+            irq_in_use = true;
         }
     }
 
-    if (pdm_mic.dma_channel > -1) {
-        dma_channel_unclaim(pdm_mic.dma_channel);
+    mic->next = pdm_active_mics;
+    pdm_active_mics = mic;
 
-        pdm_mic.dma_channel = -1;
+    mic_hal_interrupts_restore(status);
+
+    if (!irq_in_use) {
+        mic_hal_irq_add_handler(mic->dma_irq, (mic->dma_irq == 0) ? pdm_dma_irq0_handler : pdm_dma_irq1_handler);
     }
 }
 
-int pdm_microphone_start() {
-    irq_set_enabled(pdm_mic.dma_irq, true);
-    irq_set_exclusive_handler(pdm_mic.dma_irq, pdm_dma_handler);
-
-    if (pdm_mic.dma_irq == DMA_IRQ_0) {
-        dma_channel_set_irq0_enabled(pdm_mic.dma_channel, true);
-    } else if (pdm_mic.dma_irq == DMA_IRQ_1) {
-        dma_channel_set_irq1_enabled(pdm_mic.dma_channel, true);
-    } else {
+static void pdm_mic_deactivate(struct pdm_microphone* mic) {
+    bool irq_in_use = false;
+    bool was_active = false;
+
+    uint32_t status = mic_hal_interrupts_disable();
+
+    for (struct pdm_microphone** m = &pdm_active_mics; *m != NULL; ) {
+        if (*m == mic) {
+            *m = mic->next;
+            was_active = true;
+        } else {
+            if ((*m)->dma_irq == mic->dma_irq) {
+                irq_in_use = true;
+            }
+
+            m = &(*m)->next;
+        }
+    }
+
+    mic->next = NULL;
+
+    mic_hal_interrupts_restore(status);
+
+    if (was_active && !irq_in_use) {
+        mic_hal_irq_remove_handler(mic->dma_irq, (mic->dma_irq == 0) ? pdm_dma_irq0_handler : pdm_dma_irq1_handler);
+    }
+}
+
+// Everything but enabling the state machine: it is left stopped at the start
+// of its program with an empty FIFO and its DMA channel armed, so enabling it
+// starts the PDM clock on a sample boundary.
+static int pdm_mic_prepare(struct pdm_microphone* mic) {
+    if (mic->dma_irq >= MIC_HAL_DMA_IRQ_COUNT) {
         return -1;
     }
 
-    Open_PDM_Filter_Init(&pdm_mic.filter);
+    // before anything is enabled, so a failure leaves nothing to undo
+    for (uint i = 0; i < mic->channels; i++) {
+        if (Open_PDM_Filter_Init(&mic->filter[i]) < 0) {
+            return -1;
+        }
+    }
 
-    pio_sm_set_enabled(
-        pdm_mic.config.pio,
-        pdm_mic.config.pio_sm,
-        true
-    );
+    mic_hal_dma_set_irq_enabled(mic->dma_channel, mic->dma_irq, true);
 
-    pdm_mic.raw_buffer_write_index = 0;
-    pdm_mic.raw_buffer_read_index = 0;
+    mic_hal_pdm_reset(mic->config.pio, mic->config.pio_sm, mic->pio_sm_offset);
 
-    dma_channel_transfer_to_buffer_now(
-        pdm_mic.dma_channel,
-        pdm_mic.raw_buffer[0],
-        pdm_mic.raw_buffer_size
-    );
+    mic->raw_buffer_produced = 0;
+    mic->raw_buffer_consumed = 0;
+    mic->raw_buffer_offset = 0;
 
-    pio_sm_set_enabled(
-        pdm_mic.config.pio,
-        pdm_mic.config.pio_sm,
-        true
-    );
+    pdm_mic_activate(mic);
+
+    mic_hal_dma_capture_start(mic->dma_channel, mic->dma_control_channel, mic->dma_write_addr, mic->dma_transfer_count);
+
+    return 0;
 }
 
-void pdm_microphone_stop() {
-    pio_sm_set_enabled(
-        pdm_mic.config.pio,
-        pdm_mic.config.pio_sm,
-        false
-    );
+int pdm_mic_start(struct pdm_microphone* mic) {
+    if (pdm_mic_prepare(mic) < 0) {
+        return -1;
+    }
+
+    mic_hal_pdm_set_enabled(mic->config.pio, mic->config.pio_sm, true);
 
-    dma_channel_abort(pdm_mic.dma_channel);
+    return 0;
+}
+
+int pdm_mic_start_group(struct pdm_microphone** mics, uint count) {
+    uint32_t sm_mask = 0;
+
+    if (count == 0) {
+        return -1;
+    }
+
+    // the state machines can only be enabled together within one PIO, and
+    // only stay in step with the same clock divider
+    for (uint i = 0; i < count; i++) {
+        if (mics[i]->config.pio != mics[0]->config.pio ||
+            mics[i]->config.sample_rate != mics[0]->config.sample_rate ||
+            (sm_mask & (1u << mics[i]->config.pio_sm))) {
+            return -1;
+        }
 
-    if (pdm_mic.dma_irq == DMA_IRQ_0) {
-        dma_channel_set_irq0_enabled(pdm_mic.dma_channel, false);
-    } else if (pdm_mic.dma_irq == DMA_IRQ_1) {
-        dma_channel_set_irq1_enabled(pdm_mic.dma_channel, false);
+        sm_mask |= (1u << mics[i]->config.pio_sm);
     }
 
-    irq_set_enabled(pdm_mic.dma_irq, false);
+    for (uint i = 0; i < count; i++) {
+        if (pdm_mic_prepare(mics[i]) < 0) {
+            for (uint j = 0; j < i; j++) {
+                pdm_mic_stop(mics[j]);
+            }
+
+            return -1;
+        }
+    }
+
+    // also restarts the clock dividers, so the PDM clocks are in phase and
+    // sample k of every instance is from the same clock edge
+    mic_hal_pdm_enable_in_sync(mics[0]->config.pio, sm_mask);
+
+    return 0;
 }
 
-static void pdm_dma_handler() {
-    // clear IRQ
-    if (pdm_mic.dma_irq == DMA_IRQ_0) {
-        dma_hw->ints0 = (1u << pdm_mic.dma_channel);
-    } else if (pdm_mic.dma_irq == DMA_IRQ_1) {
-        dma_hw->ints1 = (1u << pdm_mic.dma_channel);
+void pdm_mic_stop(struct pdm_microphone* mic) {
+    mic_hal_pdm_set_enabled(mic->config.pio, mic->config.pio_sm, false);
+
+    mic_hal_dma_set_irq_enabled(mic->dma_channel, mic->dma_irq, false);
+
+    mic_hal_dma_capture_stop(mic->dma_channel, mic->dma_control_channel);
+
+    pdm_mic_deactivate(mic);
+}
+
+static void pdm_mic_dma_complete(struct pdm_microphone* mic) {
+#if PDM_MICROPHONE_STATS
+    // transfers since the buffer was full: in the next buffer, or the words
+    // waiting in the FIFO as the channel is stopped
+#if PDM_MICROPHONE_CHAINED_DMA
+    uint32_t remaining = mic_hal_dma_remaining(mic->dma_channel);
+    uint32_t latency = remaining ? (mic->dma_transfer_count - remaining) : 0;
+#else
+    uint32_t latency = mic_hal_pdm_fifo_level(mic->config.pio, mic->config.pio_sm);
+#endif
+
+    if (latency > mic->stats_isr_latency_max) {
+        mic->stats_isr_latency_max = latency;
     }
+    mic->stats_isr_latency_sum += latency;
+    mic->stats_isr_count++;
+#endif
+
+    // the next buffer, the control channel already started the dma on it
+    uint32_t produced = mic->raw_buffer_produced + 1;
 
-    // get the current buffer index
-    pdm_mic.raw_buffer_read_index = pdm_mic.raw_buffer_write_index;
+    mic->raw_buffer_produced = produced;
 
-    // get the next capture index to send the dma to start
-    pdm_mic.raw_buffer_write_index = (pdm_mic.raw_buffer_write_index + 1) % PDM_RAW_BUFFER_COUNT;
+    // it still holds the oldest unread buffer
+    if (produced - mic->raw_buffer_consumed >= mic->raw_buffer_count) {
+        mic->raw_buffer_overruns++;
+    }
 
+#if !PDM_MICROPHONE_CHAINED_DMA
     // give the channel a new buffer to write to and re-trigger it
-    dma_channel_transfer_to_buffer_now(
-        pdm_mic.dma_channel,
-        pdm_mic.raw_buffer[pdm_mic.raw_buffer_write_index],
-        pdm_mic.raw_buffer_size
-    );
+    mic_hal_dma_capture_next(mic->dma_channel, mic->raw_buffer[produced % mic->raw_buffer_count], mic->dma_transfer_count);
+#endif
 
-    if (pdm_mic.samples_ready_handler) {
-        pdm_mic.samples_ready_handler();
+    if (mic->samples_ready_handler) {
+        mic->samples_ready_handler(mic);
     }
 }
 
-void pdm_microphone_set_samples_ready_handler(pdm_samples_ready_handler_t handler) {
-    pdm_mic.samples_ready_handler = handler;
+// shared with other DMA users of the IRQ: only handles and clears the
+// channels of started instances
+static void pdm_dma_irq_handler(uint irq) {
+    for (struct pdm_microphone* mic = pdm_active_mics; mic != NULL; mic = mic->next) {
+        if (mic->dma_irq == irq && mic_hal_dma_irq_clear(irq, mic->dma_channel)) {
+            pdm_mic_dma_complete(mic);
+        }
+    }
 }
 
-void pdm_microphone_set_filter_max_volume(uint8_t max_volume) {
-    pdm_mic.filter.MaxVolume = max_volume;
+static void pdm_dma_irq0_handler() {
+    pdm_dma_irq_handler(0);
 }
 
-void pdm_microphone_set_filter_gain(uint8_t gain) {
-    pdm_mic.filter.Gain = gain;
+static void pdm_dma_irq1_handler() {
+    pdm_dma_irq_handler(1);
 }
 
-void pdm_microphone_set_filter_volume(uint16_t volume) {
-    pdm_mic.filter_volume = volume;
+void pdm_mic_set_samples_ready_handler(struct pdm_microphone* mic, pdm_mic_samples_ready_handler_t handler) {
+    mic->samples_ready_handler = handler;
 }
 
-int pdm_microphone_read(int16_t* buffer, size_t samples) {
-    int filter_stride = (pdm_mic.filter.Fs / 1000);
-    samples = (samples / filter_stride) * filter_stride;
+void pdm_mic_set_filter_max_volume(struct pdm_microphone* mic, uint8_t max_volume) {
+    for (int i = 0; i < PDM_MICROPHONE_MAX_CHANNELS; i++) {
+        mic->filter[i].MaxVolume = max_volume;
+    }
+}
 
-    if (samples > pdm_mic.config.sample_buffer_size) {
-        samples = pdm_mic.config.sample_buffer_size;
+void pdm_mic_set_filter_gain(struct pdm_microphone* mic, uint8_t gain) {
+    for (int i = 0; i < PDM_MICROPHONE_MAX_CHANNELS; i++) {
+        mic->filter[i].Gain = gain;
     }
+}
+
+void pdm_mic_set_filter_volume(struct pdm_microphone* mic, uint16_t volume) {
+    mic->filter_volume = volume;
+}
+
+// pdm_decode() with statistics, samples counting every channel
+static void pdm_mic_decode(struct pdm_microphone* mic, uint8_t* in, int16_t* out, size_t samples) {
+#if PDM_MICROPHONE_STATS
+    size_t filter_stride = mic->filter[0].FrameSamples * mic->channels;
+
+    mic_hal_cycles_init();
 
-    if (pdm_mic.raw_buffer_write_index == pdm_mic.raw_buffer_read_index) {
-        return 0;
+    uint32_t block_start = mic_hal_cycles();
+
+    if (mic->channels > 1) {
+        pdm_transpose(in, samples * (PDM_DECIMATION / 8), mic->channels);
     }
 
-    uint8_t* in = pdm_mic.raw_buffer[pdm_mic.raw_buffer_read_index];
-    int16_t* out = buffer;
+    for (size_t i = 0; i < samples; i += filter_stride) {
+        size_t frame_samples = (samples - i < filter_stride) ? (samples - i) : filter_stride;
+        uint32_t frame_start = mic_hal_cycles();
+
+        pdm_decode_samples(mic->filter, mic->channel_offset, mic->channels, mic->filter_volume, in, out, frame_samples / mic->channels);
 
-    pdm_mic.raw_buffer_read_index++;
+        uint32_t frame_cycles = mic_hal_cycles_since(frame_start);
+
+        if (frame_cycles > mic->stats_frame_cycles_max) {
+            mic->stats_frame_cycles_max = frame_cycles;
+        }
+        mic->stats_frame_cycles_sum += frame_cycles;
+        mic->stats_frames++;
 
-    for (int i = 0; i < samples; i += filter_stride) {
-#if PDM_DECIMATION == 64
-        Open_PDM_Filter_64(in, out, pdm_mic.filter_volume, &pdm_mic.filter);
-#elif PDM_DECIMATION == 128
-        Open_PDM_Filter_128(in, out, pdm_mic.filter_volume, &pdm_mic.filter);
+        in += frame_samples * (PDM_DECIMATION / 8);
+        out += frame_samples;
+    }
 #else
-        #error "Unsupported PDM_DECIMATION value!"
+    pdm_decode(mic->filter, mic->channel_offset, mic->channels, PDM_DECIMATION, mic->filter_volume, in, out, samples);
+#endif
+
+#if PDM_MICROPHONE_STATS
+    uint32_t block_cycles = mic_hal_cycles_since(block_start);
+
+    if (block_cycles > mic->stats_block_cycles_max) {
+        mic->stats_block_cycles_max = block_cycles;
+    }
+    mic->stats_block_cycles_sum += block_cycles;
+    mic->stats_buffers_decoded++;
 #endif
+}
+
+int pdm_mic_read(struct pdm_microphone* mic, int16_t* buffer, size_t samples) {
+    samples -= samples % mic->channels;
+
+    uint32_t produced = mic->raw_buffer_produced;
+    uint32_t consumed = mic->raw_buffer_consumed;
+    size_t offset = mic->raw_buffer_offset;
+    size_t read = 0;
 
-        in += filter_stride * (PDM_DECIMATION / 8);
-        out += filter_stride;
+    // skip to the oldest buffer the DMA is not writing to, the rest of a
+    // partly read one is lost
+    if (produced - consumed >= mic->raw_buffer_count) {
+        mic->raw_buffers_dropped += produced - consumed - (mic->raw_buffer_count - 1);
+
+        consumed = produced - (mic->raw_buffer_count - 1);
+        offset = 0;
     }
 
-    return samples;
+    while (samples > 0 && consumed != produced) {
+        size_t buffer_samples = mic->config.sample_buffer_size - offset;
+
+        if (buffer_samples > samples) {
+            buffer_samples = samples;
+        }
+
+        pdm_mic_decode(
+            mic,
+            mic->raw_buffer[consumed % mic->raw_buffer_count] + offset * (PDM_DECIMATION / 8),
+            buffer + read,
+            buffer_samples
+        );
+
+        offset += buffer_samples;
+        read += buffer_samples;
+        samples -= buffer_samples;
+
+        if (offset == mic->config.sample_buffer_size) {
+            consumed++;
+            offset = 0;
+        }
+    }
+
+    mic->raw_buffer_consumed = consumed;
+    mic->raw_buffer_offset = offset;
+
+    return read;
+}
+
+const int16_t* pdm_mic_acquire(struct pdm_microphone* mic, size_t* samples) {
+    uint block_count = mic->config.block_count;
+
+    if (mic->blocks_acquired - mic->blocks_released >= block_count) {
+        return NULL;
+    }
+
+    int16_t* block = mic->blocks + (mic->blocks_acquired % block_count) * mic->config.sample_buffer_size;
+
+    int read = pdm_mic_read(mic, block, mic->config.sample_buffer_size);
+
+    if (read == 0) {
+        return NULL;
+    }
+
+    mic->blocks_acquired++;
+    *samples = read;
+
+    return block;
+}
+
+void pdm_mic_release(struct pdm_microphone* mic) {
+    if (mic->blocks_released != mic->blocks_acquired) {
+        mic->blocks_released++;
+    }
+}
+
+uint pdm_mic_get_raw_buffers_available(struct pdm_microphone* mic) {
+    uint32_t available = mic->raw_buffer_produced - mic->raw_buffer_consumed;
+
+    return (available < mic->raw_buffer_count) ? available : (mic->raw_buffer_count - 1);
+}
+
+uint32_t pdm_mic_get_overruns(struct pdm_microphone* mic) {
+    return mic->raw_buffer_overruns;
+}
+
+uint32_t pdm_mic_get_dropped_buffers(struct pdm_microphone* mic) {
+    return mic->raw_buffers_dropped;
+}
+
+void pdm_mic_get_stats(struct pdm_microphone* mic, struct pdm_microphone_stats* stats) {
+    memset(stats, 0x00, sizeof(*stats));
+
+    stats->buffers_captured = mic->raw_buffer_produced;
+    stats->buffers_decoded = mic->raw_buffer_consumed - mic->raw_buffers_dropped;
+    stats->overruns = mic->raw_buffer_overruns;
+    stats->dropped_buffers = mic->raw_buffers_dropped;
+
+#if PDM_MICROPHONE_STATS
+    // a DMA transfer holds 8 bits of every channel, or 4 with 8 channels
+    uint64_t transfer_clocks = ((mic->raw_buffer_size / mic->dma_transfer_count) * 8) / mic->channels;
+    uint64_t clock_hz = (uint64_t)mic->config.sample_rate * PDM_DECIMATION;
+
+    stats->isr_latency_max_us = (mic->stats_isr_latency_max * transfer_clocks * 1000000) / clock_hz;
+    if (mic->stats_isr_count) {
+        stats->isr_latency_avg_us = (mic->stats_isr_latency_sum * transfer_clocks * 1000000) / (clock_hz * mic->stats_isr_count);
+    }
+
+    stats->frame_cycles_max = mic->stats_frame_cycles_max;
+    if (mic->stats_frames) {
+        stats->frame_cycles_avg = mic->stats_frame_cycles_sum / mic->stats_frames;
+        stats->filter_cycles_avg = mic->stats_frame_cycles_sum / ((uint64_t)mic->stats_frames * mic->channels);
+    }
+
+    stats->block_cycles_max = mic->stats_block_cycles_max;
+    if (mic->stats_buffers_decoded) {
+        stats->block_cycles_avg = mic->stats_block_cycles_sum / mic->stats_buffers_decoded;
+    }
+
+#ifdef USE_STATS
+    for (uint i = 0; i < mic->channels; i++) {
+        stats->saturations += mic->filter[i].Saturations;
+    }
+#endif
+#endif
+}
+
+// only the decode and latency counters, the buffer counts run on
+void pdm_mic_reset_stats(struct pdm_microphone* mic) {
+#if PDM_MICROPHONE_STATS
+    mic->stats_isr_latency_max = 0;
+    mic->stats_isr_latency_sum = 0;
+    mic->stats_isr_count = 0;
+    mic->stats_buffers_decoded = 0;
+    mic->stats_frames = 0;
+    mic->stats_frame_cycles_max = 0;
+    mic->stats_frame_cycles_sum = 0;
+    mic->stats_block_cycles_max = 0;
+    mic->stats_block_cycles_sum = 0;
+
+#ifdef USE_STATS
+    for (uint i = 0; i < mic->channels; i++) {
+        mic->filter[i].Saturations = 0;
+    }
+#endif
+#endif
+}
+
+static void pdm_mic_default_samples_ready(struct pdm_microphone* mic) {
+    (void)mic;
+
+    if (pdm_mic_default_handler) {
+        pdm_mic_default_handler();
+    }
+}
+
+int pdm_microphone_init(const struct pdm_microphone_config* config) {
+    return pdm_mic_init(&pdm_mic, config);
+}
+
+int pdm_microphone_init_static(const struct pdm_microphone_config* config, uint8_t* raw_buffers, int16_t* blocks) {
+    return pdm_mic_init_static(&pdm_mic, config, raw_buffers, blocks);
+}
+
+void pdm_microphone_deinit() {
+    pdm_mic_deinit(&pdm_mic);
+}
+
+int pdm_microphone_start() {
+    return pdm_mic_start(&pdm_mic);
+}
+
+void pdm_microphone_stop() {
+    pdm_mic_stop(&pdm_mic);
+}
+
+void pdm_microphone_set_samples_ready_handler(pdm_samples_ready_handler_t handler) {
+    pdm_mic_default_handler = handler;
+
+    pdm_mic_set_samples_ready_handler(&pdm_mic, handler ? pdm_mic_default_samples_ready : NULL);
+}
+
+void pdm_microphone_set_filter_max_volume(uint8_t max_volume) {
+    pdm_mic_set_filter_max_volume(&pdm_mic, max_volume);
+}
+
+void pdm_microphone_set_filter_gain(uint8_t gain) {
+    pdm_mic_set_filter_gain(&pdm_mic, gain);
+}
+
+void pdm_microphone_set_filter_volume(uint16_t volume) {
+    pdm_mic_set_filter_volume(&pdm_mic, volume);
+}
+
+int pdm_microphone_read(int16_t* buffer, size_t samples) {
+    return pdm_mic_read(&pdm_mic, buffer, samples);
+}
+
+const int16_t* pdm_microphone_acquire(size_t* samples) {
+    return pdm_mic_acquire(&pdm_mic, samples);
+}
+
+void pdm_microphone_release() {
+    pdm_mic_release(&pdm_mic);
+}
+
+uint pdm_microphone_get_raw_buffers_available() {
+    return pdm_mic_get_raw_buffers_available(&pdm_mic);
+}
+
+uint32_t pdm_microphone_get_overruns() {
+    return pdm_mic_get_overruns(&pdm_mic);
+}
+
+uint32_t pdm_microphone_get_dropped_buffers() {
+    return pdm_mic_get_dropped_buffers(&pdm_mic);
+}
+
+void pdm_microphone_get_stats(struct pdm_microphone_stats* stats) {
+    pdm_mic_get_stats(&pdm_mic, stats);
+}
+
+void pdm_microphone_reset_stats() {
+    pdm_mic_reset_stats(&pdm_mic);
 }
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#include <stdint.h>
+
+#include "pico/multicore.h"
+#include "pico/time.h"
+
+#include "pico/pdm_microphone_core1.h"
+
+static struct {
+    struct pdm_mic_core1_output* outputs;
+    bool started;
+    uint32_t start_us;
+    // each written by one core only
+    volatile uint32_t core0_fifo_push_us;
+    volatile uint32_t core1_busy_us;
+    volatile uint32_t blocks_decoded;
+} pdm_core1;
+
+static void pdm_mic_core1_samples_ready(struct pdm_microphone* mic) {
+    uint32_t start_us = time_us_32();
+
+    // with the FIFO full core1 is behind and reads this buffer along with
+    // the ones already signalled, the raw queue counts what it then loses
+    if (multicore_fifo_wready()) {
+        multicore_fifo_push_blocking((uintptr_t)mic);
+    }
+
+    pdm_core1.core0_fifo_push_us += time_us_32() - start_us;
+}
+
+static void pdm_mic_core1_decode(struct pdm_mic_core1_output* output) {
+    while (pdm_mic_get_raw_buffers_available(output->mic)) {
+        uint32_t produced = output->produced;
+
+        if (produced - __atomic_load_n(&output->consumed, __ATOMIC_ACQUIRE) >= output->block_count) {
+            output->full++;
+
+            return;
+        }
+
+        int16_t* block = output->blocks + (produced & (output->block_count - 1)) * output->block_samples;
+
+        pdm_mic_read(output->mic, block, output->block_samples);
+
+        // the block is written before core0 can see it
+        __atomic_store_n(&output->produced, produced + 1, __ATOMIC_RELEASE);
+
+        pdm_core1.blocks_decoded++;
+    }
+}
+
+static void pdm_mic_core1_main() {
+    while (1) {
+        struct pdm_microphone* mic = (struct pdm_microphone*)(uintptr_t)multicore_fifo_pop_blocking();
+
+        uint32_t start_us = time_us_32();
+
+        for (struct pdm_mic_core1_output* output = pdm_core1.outputs; output != NULL; output = output->next) {
+            if (output->mic == mic) {
+                pdm_mic_core1_decode(output);
+            }
+        }
+
+        pdm_core1.core1_busy_us += time_us_32() - start_us;
+    }
+}
+
+int pdm_mic_core1_add(struct pdm_microphone* mic, struct pdm_mic_core1_output* output, int16_t* blocks, uint block_count) {
+    if (pdm_core1.started || block_count == 0 || (block_count & (block_count - 1))) {
+        return -1;
+    }
+
+    output->mic = mic;
+    output->blocks = blocks;
+    output->block_count = block_count;
+    output->block_samples = mic->config.sample_buffer_size;
+    output->produced = 0;
+    output->consumed = 0;
+    output->full = 0;
+
+    output->next = pdm_core1.outputs;
+    pdm_core1.outputs = output;
+
+    pdm_mic_set_samples_ready_handler(mic, pdm_mic_core1_samples_ready);
+
+    return 0;
+}
+
+void pdm_mic_core1_start() {
+    if (pdm_core1.started) {
+        return;
+    }
+
+    pdm_core1.started = true;
+    pdm_core1.start_us = time_us_32();
+
+    multicore_launch_core1(pdm_mic_core1_main);
+}
+
+const int16_t* pdm_mic_core1_acquire(struct pdm_mic_core1_output* output, size_t* samples) {
+    uint32_t consumed = output->consumed;
+
+    // the block was written before produced was
+    if (__atomic_load_n(&output->produced, __ATOMIC_ACQUIRE) == consumed) {
+        return NULL;
+    }
+
+    *samples = output->block_samples;
+
+    return output->blocks + (consumed & (output->block_count - 1)) * output->block_samples;
+}
+
+void pdm_mic_core1_release(struct pdm_mic_core1_output* output) {
+    // done with the block before core1 may refill it
+    __atomic_store_n(&output->consumed, output->consumed + 1, __ATOMIC_RELEASE);
+}
+
+void pdm_mic_core1_get_stats(struct pdm_mic_core1_stats* stats) {
+    stats->elapsed_us = pdm_core1.started ? (time_us_32() - pdm_core1.start_us) : 0;
+    stats->core0_fifo_push_us = pdm_core1.core0_fifo_push_us;
+    stats->core1_busy_us = pdm_core1.core1_busy_us;
+    stats->blocks_decoded = pdm_core1.blocks_decoded;
+}
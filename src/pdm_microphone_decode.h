@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ */
+
+#ifndef _PDM_MICROPHONE_DECODE_H_
+#define _PDM_MICROPHONE_DECODE_H_
+
+// The decode loop of pdm_mic_read(), free of hardware dependencies so the
+// host build can run and benchmark it too.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "OpenPDM2PCM/OpenPDMFilter.h"
+
+// Transposes an 8 x 8 bit matrix held in x (rows 0 to 3) and y (rows 4 to 7),
+// row 0 in the top byte of x and column 0 in the top bit of every row
+static inline void pdm_transpose8(uint32_t* x, uint32_t* y) {
+    uint32_t t;
+
+    t = (*x ^ (*x >> 7)) & 0x00aa00aa; *x ^= t ^ (t << 7);
+    t = (*y ^ (*y >> 7)) & 0x00aa00aa; *y ^= t ^ (t << 7);
+    t = (*x ^ (*x >> 14)) & 0x0000cccc; *x ^= t ^ (t << 14);
+    t = (*y ^ (*y >> 14)) & 0x0000cccc; *y ^= t ^ (t << 14);
+
+    t = (*x & 0xf0f0f0f0) | ((*y >> 4) & 0x0f0f0f0f);
+    *y = ((*x << 4) & 0xf0f0f0f0) | (*y & 0x0f0f0f0f);
+    *x = t;
+}
+
+// 4 nibbles of v into the low nibble of 4 bytes
+static inline uint32_t pdm_spread_nibbles(uint32_t v) {
+    v = ((v & 0xff00) << 8) | (v & 0x00ff);
+
+    return ((v & 0x00f000f0) << 4) | (v & 0x000f000f);
+}
+
+// The state machine shifts in bits channels wide groups, one per clock and
+// oldest first (pin n in bit n, low clock phase above the high one). With 1
+// or 2 channels the DMA byte swaps what it pushes, so the raw data is in
+// clock order, with 4 or 8 it holds the pushed 32-bit words: transpose every
+// 8 clocks in place into one byte per group bit, which is the layout the
+// filter reads with In_MicChannels = bits.
+static inline void pdm_transpose(uint8_t* raw, size_t size, unsigned bits) {
+    if (bits == 2) {
+        uint16_t* words = (uint16_t*)raw;
+
+        for (size_t i = 0; i < size / 2; i++) {
+            // the first 4 clocks in the top byte
+            uint32_t x = __builtin_bswap16(words[i]);
+            uint32_t t;
+
+            // unshuffle odd bits to the high byte, even bits to the low one
+            t = (x ^ (x >> 1)) & 0x2222; x ^= t ^ (t << 1);
+            t = (x ^ (x >> 2)) & 0x0c0c; x ^= t ^ (t << 2);
+            t = (x ^ (x >> 4)) & 0x00f0; x ^= t ^ (t << 4);
+
+            words[i] = x;
+        }
+    } else if (bits == 4) {
+        uint32_t* words = (uint32_t*)raw;
+
+        for (size_t i = 0; i < size / 4; i++) {
+            uint32_t x = pdm_spread_nibbles(words[i] >> 16);
+            uint32_t y = pdm_spread_nibbles(words[i] & 0xffff);
+
+            pdm_transpose8(&x, &y);
+
+            // columns 7 to 4 hold bits 0 to 3
+            words[i] = y;
+        }
+    } else if (bits == 8) {
+        uint32_t* words = (uint32_t*)raw;
+
+        for (size_t i = 0; i < size / 4; i += 2) {
+            uint32_t x = words[i];
+            uint32_t y = words[i + 1];
+
+            pdm_transpose8(&x, &y);
+
+            words[i] = y;
+            words[i + 1] = x;
+        }
+    }
+}
+
+// samples of every channel interleaved, from transposed raw data
+static inline void pdm_decode_samples(TPDMFilter_InitStruct* filter, const unsigned* channel_offset, unsigned channels, uint16_t volume, uint8_t* in, int16_t* out, uint16_t samples) {
+    for (unsigned j = 0; j < channels; j++) {
+        Open_PDM_Filter_Samples(in + channel_offset[j], (uint16_t*)(out + j), volume, &filter[j], samples);
+    }
+}
+
+// samples (counting every channel) from raw data as the state machine pushed
+// it, transposed in place, FrameSamples of every channel per filter call
+static inline void pdm_decode(TPDMFilter_InitStruct* filter, const unsigned* channel_offset, unsigned channels, unsigned decimation, uint16_t volume, uint8_t* in, int16_t* out, size_t samples) {
+    size_t frame_samples = filter[0].FrameSamples * channels;
+
+    if (channels > 1) {
+        pdm_transpose(in, samples * (decimation / 8), channels);
+    }
+
+    for (size_t i = 0; i < samples; i += frame_samples) {
+        size_t n = (samples - i < frame_samples) ? (samples - i) : frame_samples;
+
+        pdm_decode_samples(filter, channel_offset, channels, volume, in, out, n / channels);
+
+        in += n * (decimation / 8);
+        out += n;
+    }
+}
+
+#endif
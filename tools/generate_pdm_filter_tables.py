@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2021 Arm Limited and Contributors. All rights reserved.
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+# Generates the OpenPDM2PCM sinc coefficients and Look-Up Tables as const
+# data, so Open_PDM_Filter_Init() only has to link to them.
+#
+#   generate_pdm_filter_tables.py --order 3 --decimations 64 128 -o OpenPDMFilter_tables.h
+
+import argparse
+
+
+def sinc_coefficients(decimation, order):
+    # order boxcars of length decimation convolved together, with a zero
+    # before and zeros after so the result is order * decimation long,
+    # as built by Open_PDM_Filter_Table_Init()
+    result = [1]
+
+    for _ in range(order):
+        conv = [0] * (len(result) + decimation - 1)
+        for i, a in enumerate(result):
+            for j in range(decimation):
+                conv[i + j] += a
+        result = conv
+
+    coef = [0] + result
+    coef += [0] * (order * decimation - len(coef))
+
+    return [coef[s * decimation:(s + 1) * decimation] for s in range(order)]
+
+
+def lut_entry(coef, byte):
+    return sum(coef[bit] for bit in range(8) if byte & (0x80 >> bit))
+
+
+def format_list(values, indent, per_line=16):
+    lines = []
+    for i in range(0, len(values), per_line):
+        lines.append(indent + ", ".join(str(v) for v in values[i:i + per_line]) + ",")
+    return "\n".join(lines)
+
+
+def generate_table(decimation, order):
+    coef = sinc_coefficients(decimation, order)
+    sub_const = sum(sum(c) for c in coef) >> 1
+    max_entry = max(lut_entry(c[d * 8:d * 8 + 8], 0xff) for c in coef for d in range(decimation // 8))
+
+    out = []
+    out.append("#if DECIMATION_MAX >= %d && (!defined(USE_LUT_16BIT) || %d <= 0xffff)" % (decimation, max_entry))
+    out.append("#define GENERATED_TABLE_%d" % decimation)
+    out.append("")
+    out.append("#ifdef USE_LUT")
+    out.append("static const TPDMFilter_LUT_Entry generated_lut_%d[%d][256][SINCN] GENERATED_TABLES_SECTION = {" % (decimation, decimation // 8))
+    for d in range(decimation // 8):
+        out.append("  {")
+        for c in range(256):
+            entries = [lut_entry(coef[s][d * 8:d * 8 + 8], c) for s in range(order)]
+            out.append("    { %s }," % ", ".join(str(e) for e in entries))
+        out.append("  },")
+    out.append("};")
+    out.append("#endif")
+    out.append("")
+    out.append("static const TPDMFilter_Table generated_table_%d GENERATED_TABLES_SECTION = {" % decimation)
+    out.append("  .Decimation = %d," % decimation)
+    out.append("  .SubConst = %d," % sub_const)
+    out.append("  .Coef = {")
+    for s in range(order):
+        out.append("    {")
+        out.append(format_list(coef[s], "      "))
+        out.append("    },")
+    out.append("  },")
+    out.append("#ifdef USE_LUT")
+    out.append("  .LUT = generated_lut_%d," % decimation)
+    out.append("#endif")
+    out.append("};")
+    out.append("#endif")
+    out.append("")
+
+    return "\n".join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate OpenPDM2PCM filter tables")
+    parser.add_argument("--order", type=int, default=3, help="sinc filter order (SINCN)")
+    parser.add_argument("--decimations", type=int, nargs="+", required=True, help="decimation factors")
+    parser.add_argument("-o", "--output", required=True, help="output header")
+    args = parser.parse_args()
+
+    if args.order < 3 or args.order > 5:
+        parser.error("unsupported order %d" % args.order)
+
+    out = []
+    out.append("/* Generated by tools/generate_pdm_filter_tables.py, do not edit. */")
+    out.append("")
+    out.append("#if SINCN != %d" % args.order)
+    out.append("#error \"Generated filter tables do not match SINCN\"")
+    out.append("#endif")
+    out.append("")
+
+    decimations = sorted(set(args.decimations))
+    for decimation in decimations:
+        if decimation % 8 or decimation < 8 or decimation > 255:
+            parser.error("unsupported decimation %d" % decimation)
+        if decimation ** args.order > 0x7fffffff:
+            parser.error("decimation %d is too large for order %d" % (decimation, args.order))
+        out.append(generate_table(decimation, args.order))
+
+    out.append("static const TPDMFilter_Table *const generated_tables[] = {")
+    for decimation in decimations:
+        out.append("#ifdef GENERATED_TABLE_%d" % decimation)
+        out.append("  &generated_table_%d," % decimation)
+        out.append("#endif")
+    out.append("  0")
+    out.append("};")
+    out.append("")
+
+    with open(args.output, "w") as f:
+        f.write("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()